@@ -1,9 +1,214 @@
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
 #include <iostream>
-#include <ctime>
+#include <set>
 #include <string>
-#include <fmt/format.h>
+#include <thread>
+
+#include <cxxopts.hpp>
+
+#include "bitcaskcpp/maintenance.h"
+
+/*
+Offline maintenance of a bitcask storage, the storage must not be opened by any
+process while a command runs:
+
+  bitcask verify --db DIR           checks the checksum of every record
+  bitcask dump --db DIR             prints the records as json lines
+  bitcask rebuild-hints --db DIR    writes the missing hint files
+  bitcask fragmentation --db DIR    prints the live and dead bytes per file
+  bitcask merge --db DIR            rewrites the live records into new files
+*/
+
+static std::string json_string(const std::string& value) {
+    std::string out = "\"";
+    for (unsigned char c : value) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (c < 0x20) {
+                    out += fmt::format("\\u{:04x}", c);
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    return out + "\"";
+}
+
+static std::string human_size(size_t size) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = size;
+    size_t unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit += 1;
+    }
+    return unit == 0 ? fmt::format("{} B", size) : fmt::format("{:.1f} {}", value, units[unit]);
+}
+
+static int verify(bitcaskcpp::OfflineStorage& storage, size_t num_threads) {
+    auto results = storage.Verify(num_threads);
+    size_t num_records = 0, num_corrupted = 0, num_damaged = 0;
+    fmt::print("{:>10} {:>12} {:>10} {:>10}  {}\n", "file", "size", "records", "corrupted", "status");
+    for (const auto& result : results) {
+        std::string status = "ok";
+        if (result.first_corrupted) {
+            status = fmt::format("first corrupted record at offset {}", *result.first_corrupted);
+        }
+        if (!result.error.empty()) {
+            status = result.first_corrupted ? status + ", " + result.error : result.error;
+        }
+        fmt::print("{:>10} {:>12} {:>10} {:>10}  {}\n", result.file_id, human_size(result.size),
+                   result.num_records, result.num_corrupted, status);
+        num_records += result.num_records;
+        num_corrupted += result.num_corrupted;
+        num_damaged += result.IsValid() ? 0 : 1;
+    }
+    fmt::print("{} files, {} records, {} corrupted records, {} damaged files\n", results.size(),
+               num_records, num_corrupted, num_damaged);
+    return num_damaged == 0 ? 0 : 1;
+}
+
+static int dump(bitcaskcpp::OfflineStorage& storage, size_t num_threads, bool live, bool keys_only) {
+    auto print = [keys_only](const bitcaskcpp::Record& record) {
+        std::string line = fmt::format("{{\"file\":{},\"offset\":{},\"key\":{}", record.file_id,
+                                       record.offset, json_string(record.key));
+        if (!keys_only) {
+            line += ",\"value\":" + (record.tombstone ? "null" : json_string(record.value));
+        }
+        if (!record.valid) {
+            line += ",\"corrupted\":true";
+        }
+        line += "}\n";
+        // stops once the reader of the output went away
+        return std::fwrite(line.data(), 1, line.length(), stdout) == line.length();
+    };
+    if (live) {
+        storage.ForEachLive(num_threads, print);
+    } else {
+        storage.ForEachRecord(print);
+    }
+    return 0;
+}
+
+static int rebuild_hints(bitcaskcpp::OfflineStorage& storage, size_t num_threads) {
+    int status = 0;
+    auto results = storage.RebuildHints(num_threads);
+    for (const auto& result : results) {
+        if (result.error.empty()) {
+            fmt::print("file {}: {} hint entries\n", result.file_id, result.num_entries);
+        } else {
+            fmt::print("file {}: {}\n", result.file_id, result.error);
+            status = 1;
+        }
+    }
+    fmt::print("{} hint files rebuilt\n", results.size());
+    return status;
+}
+
+static int fragmentation(bitcaskcpp::OfflineStorage& storage, size_t num_threads) {
+    size_t total = 0, live = 0;
+    fmt::print("{:>10} {:>12} {:>12} {:>12} {:>10} {:>9}  {}\n", "file", "size", "live", "dead",
+               "live keys", "dead %", "hint");
+    for (const auto& usage : storage.Fragmentation(num_threads)) {
+        fmt::print("{:>10} {:>12} {:>12} {:>12} {:>10} {:>8.1f}%  {}\n", usage.file_id,
+                   human_size(usage.total_size), human_size(usage.live_size),
+                   human_size(usage.total_size - usage.live_size), usage.num_live,
+                   usage.Fragmentation() * 100, usage.has_hint ? "yes" : "no");
+        total += usage.total_size;
+        live += usage.live_size;
+    }
+    fmt::print("total {}, live {}, dead {} ({:.1f}%)\n", human_size(total), human_size(live),
+               human_size(total - live), total == 0 ? 0.0 : 100.0 * (total - live) / total);
+    return 0;
+}
+
+static int merge(bitcaskcpp::OfflineStorage& storage, size_t num_threads, size_t max_file_size) {
+    auto summary = storage.Merge(num_threads, max_file_size);
+    fmt::print("merged {} files ({}) into {} files ({}), {} live keys\n", summary.num_input_files,
+               human_size(summary.input_size), summary.output_files.size(),
+               human_size(summary.output_size), summary.num_keys);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    cxxopts::Options cli("bitcask", "offline maintenance of a closed bitcask storage");
+    cli.positional_help("verify|dump|rebuild-hints|fragmentation|merge");
+    cli.add_options()
+        ("command", "verify, dump, rebuild-hints, fragmentation or merge",
+            cxxopts::value<std::string>()->default_value(""))
+        ("db", "database directory", cxxopts::value<std::string>()->default_value(""))
+        ("cold-dir", "cold storage directory of a tiered database",
+            cxxopts::value<std::string>()->default_value(""))
+        ("threads", "number of threads",
+            cxxopts::value<size_t>()->default_value(
+                std::to_string(std::max<unsigned>(std::thread::hardware_concurrency(), 1))))
+        ("live", "dump: only the latest version of the live keys, in key order")
+        ("keys", "dump: only the keys")
+        ("max-file-size", "merge: size of the merged files, 0 writes a file per thread",
+            cxxopts::value<size_t>()->default_value("0"))
+        ("h,help", "print usage");
+    cli.parse_positional({"command"});
+
+    // a closed pipe fails the writes instead of killing the process, so that
+    // the storage lock is released
+    std::signal(SIGPIPE, SIG_IGN);
+
+    try {
+        auto result = cli.parse(argc, argv);
+        std::string command = result["command"].as<std::string>();
+        std::string db_path = result["db"].as<std::string>();
+        if (result.count("help") || command.empty()) {
+            std::cout << cli.help() << std::endl;
+            return command.empty() && !result.count("help") ? 1 : 0;
+        }
+        // rejected before the storage is locked
+        const std::set<std::string> commands{"verify", "dump", "rebuild-hints", "fragmentation",
+                                             "merge"};
+        if (commands.count(command) == 0) {
+            std::cerr << "unknown command: " << command << std::endl << cli.help() << std::endl;
+            return 1;
+        }
+        if (db_path.empty()) {
+            std::cerr << "--db is required" << std::endl;
+            return 1;
+        }
 
-int main() {
-    std::string s = fmt::format("I'd rather be {1} than {0}.", "right", "happy");
-    std::cout << s << "\n";
-}
\ No newline at end of file
+        size_t num_threads = std::max<size_t>(result["threads"].as<size_t>(), 1);
+        // the commands that only read leave the storage as they found it
+        bool read_only = command == "verify" || command == "dump" || command == "fragmentation";
+        bitcaskcpp::OfflineStorage storage(db_path, result["cold-dir"].as<std::string>(),
+                                           read_only);
+        if (command == "verify") {
+            return verify(storage, num_threads);
+        } else if (command == "dump") {
+            return dump(storage, num_threads, result.count("live") > 0, result.count("keys") > 0);
+        } else if (command == "rebuild-hints") {
+            return rebuild_hints(storage, num_threads);
+        } else if (command == "fragmentation") {
+            return fragmentation(storage, num_threads);
+        }
+        return merge(storage, num_threads, result["max-file-size"].as<size_t>());
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "http_api.h"
+#include "scan.h"
+
+namespace server {
+
+static const size_t DEFAULT_SCAN_LIMIT = 100;
+static const size_t MAX_SCAN_LIMIT = 10000;
+
+// route parameters are matched on the raw url
+static std::string url_decode(const std::string &value) {
+    std::string decoded;
+    decoded.reserve(value.size());
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '%' && i + 2 < value.size() &&
+            std::isxdigit(static_cast<unsigned char>(value[i + 1])) &&
+            std::isxdigit(static_cast<unsigned char>(value[i + 2]))) {
+            decoded.push_back(static_cast<char>(std::stoi(value.substr(i + 1, 2), nullptr, 16)));
+            i += 2;
+        } else {
+            decoded.push_back(value[i]);
+        }
+    }
+    return decoded;
+}
+
+static crow::response text(int code, const std::string &body) {
+    crow::response response(code, body);
+    response.set_header("Content-Type", "text/plain");
+    return response;
+}
+
+// keys and values are stored as C strings
+static bool has_nul(const std::string &value) {
+    return value.find('\0') != std::string::npos;
+}
+
+void register_routes(crow::SimpleApp &app, bitcaskcpp::Bitcask &storage) {
+    CROW_ROUTE(app, "/kv/<path>")
+        .methods("GET"_method, "PUT"_method, "POST"_method, "DELETE"_method)(
+            [&storage](const crow::request &request, std::string raw_key) {
+                std::string key = url_decode(raw_key);
+                if (key.empty() || has_nul(key))
+                    return text(400, "invalid key");
+                try {
+                    if (request.method == "GET"_method) {
+                        auto values = storage.MultiGet({key});
+                        if (!values[0])
+                            return text(404, "not found");
+                        crow::response response(200, *values[0]);
+                        response.set_header("Content-Type", "application/octet-stream");
+                        return response;
+                    }
+                    if (request.method == "DELETE"_method) {
+                        if (!storage.Has(key.c_str()))
+                            return text(404, "not found");
+                        storage.Delete(key.c_str());
+                        return crow::response(204);
+                    }
+                    if (has_nul(request.body))
+                        return text(400, "values cannot contain NUL bytes");
+                    storage.Put(key.c_str(), request.body.c_str());
+                    return crow::response(204);
+                } catch (const std::exception &e) {
+                    return text(500, e.what());
+                }
+            });
+
+    CROW_ROUTE(app, "/mget").methods("POST"_method)([&storage](const crow::request &request) {
+        auto body = crow::json::load(request.body);
+        if (!body || body.t() != crow::json::type::List)
+            return text(400, "expected a json array of keys");
+        std::vector<std::string> keys;
+        for (const auto &item : body) {
+            if (item.t() != crow::json::type::String)
+                return text(400, "keys must be strings");
+            keys.push_back(item.s());
+        }
+        try {
+            auto values = storage.MultiGet(keys);
+            crow::json::wvalue result;
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (values[i]) {
+                    result[keys[i]] = *values[i];
+                } else {
+                    result[keys[i]] = nullptr;
+                }
+            }
+            return crow::response(std::move(result));
+        } catch (const std::exception &e) {
+            return text(500, e.what());
+        }
+    });
+
+    CROW_ROUTE(app, "/scan")([&storage](const crow::request &request) {
+        const char *prefix = request.url_params.get("prefix");
+        const char *start = request.url_params.get("start");
+        const char *limit = request.url_params.get("limit");
+        size_t count = limit != nullptr ? std::strtoul(limit, nullptr, 10) : DEFAULT_SCAN_LIMIT;
+        count = std::clamp<size_t>(count, 1, MAX_SCAN_LIMIT);
+        try {
+            ScanPage page = scan_page(storage, start != nullptr ? start : "",
+                                      prefix != nullptr ? prefix : "", count);
+            crow::json::wvalue result;
+            result["items"] = crow::json::wvalue::list();
+            for (size_t i = 0; i < page.items.size(); ++i) {
+                result["items"][i]["key"] = page.items[i].first;
+                result["items"][i]["value"] = page.items[i].second;
+            }
+            if (page.next) {
+                result["next"] = *page.next;
+            } else {
+                result["next"] = nullptr;
+            }
+            return crow::response(std::move(result));
+        } catch (const std::exception &e) {
+            return text(500, e.what());
+        }
+    });
+
+    CROW_ROUTE(app, "/stats")([&storage]() {
+        bitcaskcpp::BitcaskStats stats = storage.Statistics();
+        crow::json::wvalue result;
+        result["disposable"] = stats.disposable;
+        result["total"] = stats.total;
+        result["num_files"] = stats.num_files;
+        result["num_entries"] = stats.num_entries;
+        result["num_inline_values"] = stats.num_inline_values;
+        result["inline_memory"] = stats.inline_memory;
+        return crow::response(std::move(result));
+    });
+
+    CROW_ROUTE(app, "/metrics")([&storage]() {
+        crow::response response(200, storage.Metrics().ToPrometheus());
+        response.set_header("Content-Type", "text/plain; version=0.0.4");
+        return response;
+    });
+}
+
+}  // namespace server
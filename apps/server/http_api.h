@@ -0,0 +1,24 @@
+#pragma once
+
+#include "bitcaskcpp/bitcask.h"
+#include "crow/crow_all.h"
+
+namespace server {
+
+/*
+HTTP/1.1 (keep-alive) routes over the storage:
+
+  GET    /kv/<key>                      value as the body, 404 if absent
+  PUT    /kv/<key>                      stores the request body
+  DELETE /kv/<key>                      204, 404 if absent
+  POST   /mget                          ["k1", "k2"] -> {"k1": "v1", "k2": null}
+  GET    /scan?prefix=&start=&limit=    {"items": [{"key", "value"}], "next": key|null}
+  GET    /stats                         BitcaskStats as json
+  GET    /metrics                       prometheus text format
+
+Scans are paginated, a request reads at most limit entries (default 100, at
+most 10000) and resumes from the returned next key.
+*/
+void register_routes(crow::SimpleApp &app, bitcaskcpp::Bitcask &storage);
+
+}  // namespace server
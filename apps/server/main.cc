@@ -1,15 +1,117 @@
-#include "crow/crow_all.h"
+#include <pthread.h>
 
+#include <algorithm>
+#include <csignal>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <cxxopts.hpp>
+
+#include "bitcaskcpp/bitcask.h"
+#include "crow/crow_all.h"
+#include "http_api.h"
+#include "resp_server.h"
+
+int main(int argc, char **argv) {
+    size_t cores = std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+    cxxopts::Options cli("server", "HTTP and redis protocol server of a bitcask storage");
+    cli.add_options()
+        ("db", "database directory", cxxopts::value<std::string>()->default_value("bitcask-db"))
+        ("address", "listen address", cxxopts::value<std::string>()->default_value("0.0.0.0"))
+        ("http-port", "HTTP port, 0 disables it", cxxopts::value<uint16_t>()->default_value("8181"))
+        ("resp-port", "redis protocol port, 0 disables it", cxxopts::value<uint16_t>()->default_value("6380"))
+        ("threads", "number of redis protocol event loops",
+            cxxopts::value<size_t>()->default_value(std::to_string(cores)))
+        ("http-threads", "number of HTTP worker threads",
+            cxxopts::value<size_t>()->default_value(std::to_string(cores)))
+        ("io-threads", "BitcaskOption::io_threads", cxxopts::value<size_t>()->default_value("0"))
+        ("write-buffer-size", "BitcaskOption::write_buffer_size", cxxopts::value<size_t>()->default_value("0"))
+        ("max-file-size", "BitcaskOption::max_file_size", cxxopts::value<size_t>()->default_value("0"))
+        ("memtable-size", "BitcaskOption::memtable_size", cxxopts::value<size_t>()->default_value("0"))
+        ("low-memory-keydir", "BitcaskOption::low_memory_keydir")
+        ("max-open-files", "BitcaskOption::max_open_files", cxxopts::value<size_t>()->default_value("0"))
+        ("sync-writes", "BitcaskOption::sync_writes")
+        ("cold-dir", "BitcaskOption::cold_storage_dir", cxxopts::value<std::string>()->default_value(""))
+        ("h,help", "print usage");
+
+    std::string db_path, address;
+    uint16_t http_port, resp_port;
+    size_t num_loops, http_threads;
+    bitcaskcpp::BitcaskOption options;
+    try {
+        auto result = cli.parse(argc, argv);
+        if (result.count("help")) {
+            std::cout << cli.help() << std::endl;
+            return 0;
+        }
+        db_path = result["db"].as<std::string>();
+        address = result["address"].as<std::string>();
+        http_port = result["http-port"].as<uint16_t>();
+        resp_port = result["resp-port"].as<uint16_t>();
+        num_loops = std::max<size_t>(result["threads"].as<size_t>(), 1);
+        http_threads = std::max<size_t>(result["http-threads"].as<size_t>(), 1);
+        options.io_threads = result["io-threads"].as<size_t>();
+        options.write_buffer_size = result["write-buffer-size"].as<size_t>();
+        if (result["max-file-size"].as<size_t>() > 0) {
+            options.max_file_size = result["max-file-size"].as<size_t>();
+        }
+        options.memtable_size = result["memtable-size"].as<size_t>();
+        options.low_memory_keydir = result.count("low-memory-keydir") > 0;
+        options.max_open_files = result["max-open-files"].as<size_t>();
+        options.sync_writes = result.count("sync-writes") > 0;
+        options.cold_storage_dir = result["cold-dir"].as<std::string>();
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl << cli.help() << std::endl;
+        return 1;
+    }
+    if (http_port == 0 && resp_port == 0) {
+        std::cerr << "both endpoints are disabled" << std::endl;
+        return 1;
+    }
+
+    // peers closing their socket must not kill the process
+    std::signal(SIGPIPE, SIG_IGN);
+
+    bitcaskcpp::Bitcask storage(db_path, options);
+    try {
+        storage.Open();
+    } catch (const std::exception &e) {
+        std::cerr << "unable to open " << db_path << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    // event loop threads inherit the mask, only this thread receives the signals
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
 
-int main(){
-    crow::SimpleApp app;
+    std::unique_ptr<server::RespServer> resp;
+    if (resp_port != 0) {
+        resp = std::make_unique<server::RespServer>(storage, address, resp_port, num_loops);
+        resp->Start();
+        std::cout << "redis protocol listening on " << address << ":" << resp_port << std::endl;
+    }
 
-    CROW_ROUTE(app, "/")
-    ([]() {
-        return "Hello world!";
-    });
+    if (http_port != 0) {
+        // crow handles SIGINT and SIGTERM, run returns once they are received
+        pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+        crow::SimpleApp app;
+        app.loglevel(crow::LogLevel::Warning);
+        server::register_routes(app, storage);
+        std::cout << "http listening on " << address << ":" << http_port << std::endl;
+        app.bindaddr(address).port(http_port).concurrency(http_threads).run();
+    } else {
+        int received;
+        sigwait(&signals, &received);
+    }
 
-    app.port(8181).run();
+    if (resp) {
+        resp->Stop();
+    }
+    storage.Close();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,355 @@
+#include <fnmatch.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <optional>
+
+#include "resp.h"
+#include "scan.h"
+
+namespace server {
+
+// guards against clients announcing absurd sizes
+static const int64_t MAX_ARGUMENTS = 1024 * 1024;
+static const int64_t MAX_BULK_SIZE = 512 * 1024 * 1024;
+static const size_t MAX_INLINE_SIZE = 64 * 1024;
+
+// parses the integer of a line starting at position, returns the end of line
+static std::optional<size_t> parse_line_integer(const std::string &buffer, size_t position,
+                                                int64_t &value, bool &valid) {
+    size_t end = buffer.find("\r\n", position);
+    if (end == std::string::npos) {
+        valid = buffer.size() - position < 32;
+        return std::nullopt;
+    }
+    valid = false;
+    if (end == position)
+        return end;
+    bool negative = buffer[position] == '-';
+    value = 0;
+    for (size_t i = position + (negative ? 1 : 0); i < end; ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(buffer[i])) || value > MAX_BULK_SIZE)
+            return end;
+        value = value * 10 + (buffer[i] - '0');
+    }
+    value = negative ? -value : value;
+    valid = true;
+    return end;
+}
+
+static ParseStatus parse_inline(const std::string &buffer, size_t &position,
+                                std::vector<std::string> &args, std::string &error) {
+    size_t end = buffer.find('\n', position);
+    if (end == std::string::npos) {
+        if (buffer.size() - position > MAX_INLINE_SIZE) {
+            error = "Protocol error: too big inline request";
+            return ParseStatus::Error;
+        }
+        return ParseStatus::Incomplete;
+    }
+
+    args.clear();
+    size_t line_end = end > position && buffer[end - 1] == '\r' ? end - 1 : end;
+    size_t i = position;
+    while (i < line_end) {
+        while (i < line_end && buffer[i] == ' ')
+            ++i;
+        size_t word = i;
+        while (i < line_end && buffer[i] != ' ')
+            ++i;
+        if (i > word)
+            args.emplace_back(buffer, word, i - word);
+    }
+    position = end + 1;
+    return ParseStatus::Complete;
+}
+
+ParseStatus parse_command(const std::string &buffer, size_t &position,
+                          std::vector<std::string> &args, std::string &error) {
+    if (position >= buffer.size())
+        return ParseStatus::Incomplete;
+    if (buffer[position] != '*')
+        return parse_inline(buffer, position, args, error);
+
+    int64_t count = 0;
+    bool valid = false;
+    auto end = parse_line_integer(buffer, position + 1, count, valid);
+    if (!end) {
+        if (valid)
+            return ParseStatus::Incomplete;
+        error = "Protocol error: invalid multibulk length";
+        return ParseStatus::Error;
+    }
+    if (!valid || count > MAX_ARGUMENTS) {
+        error = "Protocol error: invalid multibulk length";
+        return ParseStatus::Error;
+    }
+
+    // arguments are only kept once the whole command arrived
+    std::vector<std::pair<size_t, size_t>> ranges;
+    size_t cursor = *end + 2;
+    for (int64_t i = 0; i < count; ++i) {
+        if (cursor >= buffer.size())
+            return ParseStatus::Incomplete;
+        if (buffer[cursor] != '$') {
+            error = "Protocol error: expected '$', got '" + std::string(1, buffer[cursor]) + "'";
+            return ParseStatus::Error;
+        }
+        int64_t size = 0;
+        end = parse_line_integer(buffer, cursor + 1, size, valid);
+        if (!end) {
+            if (valid)
+                return ParseStatus::Incomplete;
+            error = "Protocol error: invalid bulk length";
+            return ParseStatus::Error;
+        }
+        if (!valid || size < 0 || size > MAX_BULK_SIZE) {
+            error = "Protocol error: invalid bulk length";
+            return ParseStatus::Error;
+        }
+        size_t data = *end + 2;
+        if (buffer.size() < data + size + 2)
+            return ParseStatus::Incomplete;
+        ranges.push_back({data, static_cast<size_t>(size)});
+        cursor = data + size + 2;
+    }
+
+    args.clear();
+    args.reserve(ranges.size());
+    for (const auto &[offset, size] : ranges) {
+        args.emplace_back(buffer, offset, size);
+    }
+    position = cursor;
+    return ParseStatus::Complete;
+}
+
+void write_simple(std::string &out, const std::string &value) {
+    out.append("+").append(value).append("\r\n");
+}
+
+void write_error(std::string &out, const std::string &message) {
+    out.append("-").append(message).append("\r\n");
+}
+
+void write_integer(std::string &out, int64_t value) {
+    out.append(":").append(std::to_string(value)).append("\r\n");
+}
+
+void write_bulk(std::string &out, const std::string &value) {
+    out.append("$").append(std::to_string(value.size())).append("\r\n");
+    out.append(value).append("\r\n");
+}
+
+void write_null(std::string &out) { out.append("$-1\r\n"); }
+
+void write_array(std::string &out, size_t size) {
+    out.append("*").append(std::to_string(size)).append("\r\n");
+}
+
+// keys and values are stored as C strings
+static bool has_nul(const std::string &value) {
+    return value.find('\0') != std::string::npos;
+}
+
+static std::string to_hex(const std::string &value) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(value.size() * 2);
+    for (unsigned char c : value) {
+        hex.push_back(digits[c >> 4]);
+        hex.push_back(digits[c & 0xf]);
+    }
+    return hex;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static std::optional<std::string> from_hex(const std::string &hex) {
+    if (hex.size() % 2 != 0)
+        return std::nullopt;
+    std::string value;
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        int high = hex_value(hex[i]);
+        int low = hex_value(hex[i + 1]);
+        if (high < 0 || low < 0)
+            return std::nullopt;
+        value.push_back(static_cast<char>(high << 4 | low));
+    }
+    return value;
+}
+
+bool CommandHandler::Execute(const std::vector<std::string> &args, std::string &out) {
+    if (args.empty())
+        return true;
+
+    std::string command = args[0];
+    std::transform(command.begin(), command.end(), command.begin(),
+                   [](unsigned char c) { return std::toupper(c); });
+    auto arity = [&](size_t min, size_t max) {
+        if (args.size() >= min && args.size() <= max)
+            return true;
+        std::string name = args[0];
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        write_error(out, "ERR wrong number of arguments for '" + name + "' command");
+        return false;
+    };
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (has_nul(args[i])) {
+            write_error(out, "ERR keys and values cannot contain NUL bytes");
+            return true;
+        }
+    }
+
+    try {
+        if (command == "GET") {
+            if (!arity(2, 2))
+                return true;
+            auto values = storage.MultiGet({args[1]});
+            values[0] ? write_bulk(out, *values[0]) : write_null(out);
+        } else if (command == "SET") {
+            if (!arity(3, 3))
+                return true;
+            storage.Put(args[1].c_str(), args[2].c_str());
+            write_simple(out, "OK");
+        } else if (command == "MGET") {
+            if (!arity(2, SIZE_MAX))
+                return true;
+            auto values = storage.MultiGet(
+                std::vector<std::string>(args.begin() + 1, args.end()));
+            write_array(out, values.size());
+            for (const auto &value : values) {
+                value ? write_bulk(out, *value) : write_null(out);
+            }
+        } else if (command == "MSET") {
+            if (!arity(args.size() % 2 == 1 ? 3 : SIZE_MAX, SIZE_MAX))
+                return true;
+            for (size_t i = 1; i < args.size(); i += 2) {
+                storage.Put(args[i].c_str(), args[i + 1].c_str());
+            }
+            write_simple(out, "OK");
+        } else if (command == "DEL") {
+            if (!arity(2, SIZE_MAX))
+                return true;
+            int64_t deleted = 0;
+            for (size_t i = 1; i < args.size(); ++i) {
+                if (!storage.Has(args[i].c_str()))
+                    continue;
+                try {
+                    storage.Delete(args[i].c_str());
+                    deleted += 1;
+                } catch (const bitcaskcpp::Exception &) {
+                    // deleted concurrently
+                    if (storage.Has(args[i].c_str()))
+                        throw;
+                }
+            }
+            write_integer(out, deleted);
+        } else if (command == "EXISTS") {
+            if (!arity(2, SIZE_MAX))
+                return true;
+            int64_t found = 0;
+            for (size_t i = 1; i < args.size(); ++i) {
+                found += storage.Has(args[i].c_str()) ? 1 : 0;
+            }
+            write_integer(out, found);
+        } else if (command == "SCAN") {
+            scan(args, out);
+        } else if (command == "PING") {
+            if (!arity(1, 2))
+                return true;
+            args.size() == 2 ? write_bulk(out, args[1]) : write_simple(out, "PONG");
+        } else if (command == "ECHO") {
+            if (!arity(2, 2))
+                return true;
+            write_bulk(out, args[1]);
+        } else if (command == "DBSIZE") {
+            write_integer(out, storage.Size());
+        } else if (command == "INFO") {
+            write_bulk(out, storage.Metrics().ToPrometheus());
+        } else if (command == "SAVE") {
+            storage.Sync();
+            write_simple(out, "OK");
+        } else if (command == "SELECT") {
+            if (!arity(2, 2))
+                return true;
+            args[1] == "0" ? write_simple(out, "OK") : write_error(out, "ERR DB index is out of range");
+        } else if (command == "COMMAND" || command == "CONFIG") {
+            write_array(out, 0);
+        } else if (command == "QUIT") {
+            write_simple(out, "OK");
+            return false;
+        } else {
+            write_error(out, "ERR unknown command '" + args[0] + "'");
+        }
+    } catch (const std::exception &e) {
+        write_error(out, std::string("ERR ") + e.what());
+    }
+    return true;
+}
+
+/*
+SCAN cursor [MATCH pattern] [COUNT count], the cursor is the hex encoded first
+key of the next page and "0" once the iteration is over, like redis a page may
+hold less than COUNT keys when a pattern filters them.
+*/
+void CommandHandler::scan(const std::vector<std::string> &args, std::string &out) {
+    if (args.size() < 2 || args.size() % 2 != 0) {
+        write_error(out, "ERR syntax error");
+        return;
+    }
+    std::optional<std::string> from = args[1] == "0" ? std::string() : from_hex(args[1]);
+    if (!from) {
+        write_error(out, "ERR invalid cursor");
+        return;
+    }
+
+    std::string pattern = "*";
+    size_t count = 10;
+    for (size_t i = 2; i < args.size(); i += 2) {
+        std::string option = args[i];
+        std::transform(option.begin(), option.end(), option.begin(),
+                       [](unsigned char c) { return std::toupper(c); });
+        if (option == "MATCH") {
+            pattern = args[i + 1];
+        } else if (option == "COUNT") {
+            try {
+                count = std::stoul(args[i + 1]);
+            } catch (const std::logic_error &) {
+                count = 0;
+            }
+            if (count == 0) {
+                write_error(out, "ERR value is not an integer or out of range");
+                return;
+            }
+        } else {
+            write_error(out, "ERR syntax error");
+            return;
+        }
+    }
+
+    // only the keys sharing the literal prefix of the pattern are visited
+    std::string prefix = pattern.substr(0, pattern.find_first_of("*?[\\"));
+    ScanPage page = scan_page(storage, *from, prefix, count);
+
+    std::vector<const std::string *> keys;
+    for (const auto &[key, _] : page.items) {
+        if (pattern == "*" || fnmatch(pattern.c_str(), key.c_str(), 0) == 0)
+            keys.push_back(&key);
+    }
+    write_array(out, 2);
+    write_bulk(out, page.next ? to_hex(*page.next) : "0");
+    write_array(out, keys.size());
+    for (const auto *key : keys) {
+        write_bulk(out, *key);
+    }
+}
+
+}  // namespace server
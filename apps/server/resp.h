@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bitcaskcpp/bitcask.h"
+
+namespace server {
+
+enum class ParseStatus { Complete, Incomplete, Error };
+
+/*
+Parses one command of the Redis protocol from the buffer at position, either a
+RESP array of bulk strings or an inline command (space separated words ending
+with a new line). On Complete position is moved past the command, on Incomplete
+nothing is consumed and parsing resumes once more data arrived.
+*/
+ParseStatus parse_command(const std::string &buffer, size_t &position,
+                          std::vector<std::string> &args, std::string &error);
+
+void write_simple(std::string &out, const std::string &value);
+void write_error(std::string &out, const std::string &message);
+void write_integer(std::string &out, int64_t value);
+void write_bulk(std::string &out, const std::string &value);
+void write_null(std::string &out);
+void write_array(std::string &out, size_t size);
+
+/*
+Executes the commands of a connection against the storage and appends their
+replies to its output. Supported: PING, ECHO, GET, SET, DEL, EXISTS, MGET, MSET,
+SCAN, DBSIZE, INFO, SAVE, QUIT, plus the COMMAND, CONFIG and SELECT probes that
+redis-cli and redis-benchmark issue on connect.
+*/
+class CommandHandler {
+   public:
+    explicit CommandHandler(bitcaskcpp::Bitcask &storage) : storage{storage} {}
+
+    // returns false once the connection should be closed after its replies
+    bool Execute(const std::vector<std::string> &args, std::string &out);
+
+   private:
+    bitcaskcpp::Bitcask &storage;
+
+    void scan(const std::vector<std::string> &args, std::string &out);
+};
+
+}  // namespace server
@@ -0,0 +1,254 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "resp_server.h"
+
+namespace server {
+
+static int listen_socket(const std::string &address, uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create socket: " + std::string(std::strerror(errno)));
+    }
+    int enable = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (::inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        ::close(fd);
+        throw std::runtime_error("Invalid listen address: " + address);
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(fd, SOMAXCONN) != 0) {
+        std::string error = std::strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("Unable to listen on " + address + ":" + std::to_string(port) +
+                                 ": " + error);
+    }
+    return fd;
+}
+
+EventLoop::EventLoop(bitcaskcpp::Bitcask &storage, const std::string &address, uint16_t port)
+    : handler{storage}, stopping{false} {
+    listen_fd = listen_socket(address, port);
+    epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0) {
+        throw std::runtime_error("Unable to create event loop.");
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.fd = wake_fd;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+}
+
+EventLoop::~EventLoop() {
+    for (auto &[fd, _] : connections) {
+        ::close(fd);
+    }
+    ::close(listen_fd);
+    ::close(epoll_fd);
+    ::close(wake_fd);
+}
+
+void EventLoop::Run() {
+    std::vector<epoll_event> events(256);
+    while (!stopping) {
+        int n = ::epoll_wait(epoll_fd, events.data(), events.size(), -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("epoll_wait failed: " + std::string(std::strerror(errno)));
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                accept_connections();
+                continue;
+            }
+            if (fd == wake_fd)
+                continue;
+
+            auto found = connections.find(fd);
+            if (found == connections.end())
+                continue;
+            Connection &connection = *found->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+                close(connection);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                on_writable(connection);
+                if (connections.count(fd) == 0)
+                    continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                on_readable(connection);
+            }
+        }
+    }
+}
+
+void EventLoop::Stop() {
+    stopping = true;
+    uint64_t one = 1;
+    ssize_t ignored = ::write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void EventLoop::accept_connections() {
+    while (true) {
+        int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        int enable = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        auto connection = std::make_unique<Connection>();
+        connection->fd = fd;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        connections.emplace(fd, std::move(connection));
+    }
+}
+
+void EventLoop::on_readable(Connection &connection) {
+    // level triggered, whatever is left is read on the next wake up
+    size_t size = connection.input.size();
+    connection.input.resize(size + READ_SIZE);
+    ssize_t n = ::read(connection.fd, connection.input.data() + size, READ_SIZE);
+    if (n <= 0) {
+        connection.input.resize(size);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        close(connection);
+        return;
+    }
+    connection.input.resize(size + n);
+    process(connection);
+}
+
+void EventLoop::on_writable(Connection &connection) {
+    if (!flush(connection))
+        return;
+    // replies drained, resume the commands held back by the watermark
+    process(connection);
+}
+
+void EventLoop::process(Connection &connection) {
+    std::vector<std::string> args;
+    std::string error;
+    while (!connection.closing &&
+           connection.output.size() - connection.written < OUTPUT_HIGH_WATERMARK) {
+        ParseStatus status = parse_command(connection.input, connection.parsed, args, error);
+        if (status == ParseStatus::Incomplete)
+            break;
+        if (status == ParseStatus::Error) {
+            write_error(connection.output, "ERR " + error);
+            connection.closing = true;
+            break;
+        }
+        if (!handler.Execute(args, connection.output)) {
+            connection.closing = true;
+        }
+    }
+    if (connection.parsed > 0) {
+        connection.input.erase(0, connection.parsed);
+        connection.parsed = 0;
+    }
+    flush(connection);
+}
+
+// returns false when the connection was closed
+bool EventLoop::flush(Connection &connection) {
+    while (connection.written < connection.output.size()) {
+        ssize_t n = ::send(connection.fd, connection.output.data() + connection.written,
+                           connection.output.size() - connection.written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            close(connection);
+            return false;
+        }
+        connection.written += n;
+    }
+    if (connection.written == connection.output.size()) {
+        connection.output.clear();
+        connection.written = 0;
+        if (connection.closing) {
+            close(connection);
+            return false;
+        }
+    }
+    watch(connection);
+    return true;
+}
+
+void EventLoop::watch(Connection &connection) {
+    size_t pending = connection.output.size() - connection.written;
+    bool writable = pending > 0;
+    bool readable = !connection.closing && pending < OUTPUT_HIGH_WATERMARK;
+    if (writable == connection.writable_watched && readable == connection.readable_watched)
+        return;
+
+    epoll_event event{};
+    event.events = (readable ? uint32_t(EPOLLIN) : 0) | (writable ? uint32_t(EPOLLOUT) : 0);
+    event.data.fd = connection.fd;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.writable_watched = writable;
+    connection.readable_watched = readable;
+}
+
+void EventLoop::close(Connection &connection) {
+    int fd = connection.fd;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    connections.erase(fd);
+}
+
+RespServer::RespServer(bitcaskcpp::Bitcask &storage, const std::string &address, uint16_t port,
+                       size_t num_loops) {
+    for (size_t i = 0; i < std::max<size_t>(num_loops, 1); ++i) {
+        loops.push_back(std::make_unique<EventLoop>(storage, address, port));
+    }
+}
+
+RespServer::~RespServer() { Stop(); }
+
+void RespServer::Start() {
+    for (auto &loop : loops) {
+        threads.emplace_back([&loop]() { loop->Run(); });
+    }
+}
+
+void RespServer::Stop() {
+    for (auto &loop : loops) {
+        loop->Stop();
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+}  // namespace server
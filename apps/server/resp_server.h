@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "bitcaskcpp/bitcask.h"
+#include "resp.h"
+
+namespace server {
+
+struct Connection {
+    int fd;
+    std::string input;
+    size_t parsed = 0;
+    std::string output;
+    size_t written = 0;
+    // set by QUIT or a protocol error, closed once the replies are written
+    bool closing = false;
+    bool writable_watched = false;
+    bool readable_watched = true;
+};
+
+/*
+Event loop owning a SO_REUSEPORT listening socket and an epoll instance, the
+kernel spreads incoming connections over the loops and a connection stays on
+its loop for its lifetime. Every command already received is executed before
+replying, so pipelined commands are answered with a single write.
+*/
+class EventLoop {
+   public:
+    EventLoop(bitcaskcpp::Bitcask &storage, const std::string &address, uint16_t port);
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    void Run();
+    void Stop();
+
+    // a connection whose pending replies exceed this stops being read
+    inline static const size_t OUTPUT_HIGH_WATERMARK = 16 * 1024 * 1024;
+    inline static const size_t READ_SIZE = 64 * 1024;
+
+   private:
+    CommandHandler handler;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd;
+    std::atomic<bool> stopping;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+
+    void accept_connections();
+    void on_readable(Connection &connection);
+    void on_writable(Connection &connection);
+    void process(Connection &connection);
+    bool flush(Connection &connection);
+    void watch(Connection &connection);
+    void close(Connection &connection);
+};
+
+/*
+Redis protocol endpoint served by a fixed pool of event loops.
+*/
+class RespServer {
+   public:
+    RespServer(bitcaskcpp::Bitcask &storage, const std::string &address, uint16_t port,
+               size_t num_loops);
+    ~RespServer();
+
+    void Start();
+    void Stop();
+
+   private:
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    std::vector<std::thread> threads;
+};
+
+}  // namespace server
@@ -0,0 +1,43 @@
+#include "scan.h"
+
+namespace server {
+
+struct ScanState {
+    const std::string *prefix;
+    size_t limit;
+    ScanPage *page;
+};
+
+// scan callbacks carry no context, the state of the running scan is per thread
+static thread_local ScanState *current_scan = nullptr;
+
+static int collect(std::string key, std::string value) {
+    ScanState &state = *current_scan;
+    if (key.compare(0, state.prefix->size(), *state.prefix) != 0)
+        return 1;
+    if (state.page->items.size() == state.limit) {
+        state.page->next = std::move(key);
+        return 1;
+    }
+    state.page->items.emplace_back(std::move(key), std::move(value));
+    return 0;
+}
+
+ScanPage scan_page(bitcaskcpp::Bitcask &storage, const std::string &from,
+                   const std::string &prefix, size_t limit) {
+    ScanPage page;
+    ScanState state{&prefix, limit, &page};
+    std::string start = from < prefix ? prefix : from;
+
+    current_scan = &state;
+    try {
+        storage.Scan(start.data(), collect);
+    } catch (...) {
+        current_scan = nullptr;
+        throw;
+    }
+    current_scan = nullptr;
+    return page;
+}
+
+}  // namespace server
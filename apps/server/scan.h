@@ -0,0 +1,26 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bitcaskcpp/bitcask.h"
+
+namespace server {
+
+struct ScanPage {
+    std::vector<std::pair<std::string, std::string>> items;
+    // first key of the next page, none once the range is exhausted
+    std::optional<std::string> next;
+};
+
+/*
+Reads at most limit entries starting at the from key and sharing the prefix.
+Scans are served page by page so that neither the storage lock nor the memory
+of a response grow with the size of the range.
+*/
+ScanPage scan_page(bitcaskcpp::Bitcask &storage, const std::string &from,
+                   const std::string &prefix, size_t limit);
+
+}  // namespace server
@@ -0,0 +1,373 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cxxopts.hpp>
+#include <fmt/format.h>
+
+#include "bitcaskcpp/bitcask.h"
+#include "ycsb.h"
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+/*
+YCSB style benchmark of the bitcask storage. The database is loaded with
+--records keys, then each requested workload runs --operations operations split
+over --threads client threads, throughput and latency percentiles are reported
+per operation. Cold start (Open with the page cache of the data files dropped)
+and Compact are measured at the end of the run.
+
+  ycsb --db /mnt/nvme/ycsb --records 50000000 --value-size uniform:100-4000 \
+       --workloads a,b,c,f,d,e --threads 16
+*/
+
+struct Config {
+    fs::path db_path;
+    uint64_t num_records;
+    uint64_t num_operations;
+    size_t num_threads;
+    double zipfian_theta;
+    size_t scan_length;
+    std::string distribution;
+    ycsb::SizeDistribution key_size{"fixed:24"};
+    ycsb::SizeDistribution value_size{"fixed:100"};
+    bitcaskcpp::BitcaskOption options;
+};
+
+static thread_local size_t scan_remaining = 0;
+
+static int count_scanned(std::string, std::string) {
+    scan_remaining -= 1;
+    return scan_remaining == 0 ? 1 : 0;
+}
+
+/*
+Keys are "user" followed by the 19 digits of the hashed key number, so that
+inserts are spread over the key space, padded up to a size drawn from the key
+size distribution seeded by the key number itself.
+*/
+static std::string make_key(const Config& config, uint64_t key_number) {
+    std::string key = fmt::format("user{:019}", ycsb::fnv_hash64(key_number) % 10000000000000000000ULL);
+    std::mt19937_64 rng(key_number);
+    size_t size = config.key_size.Next(rng);
+    if (key.size() < size) {
+        key.append(size - key.size(), 'a' + key_number % 26);
+    }
+    return key;
+}
+
+template <typename Rng>
+static std::string make_value(const Config& config, Rng& rng) {
+    size_t size = config.value_size.Next(rng);
+    std::string value(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+        value[i] = 'a' + rng() % 26;
+    }
+    return value;
+}
+
+static uint64_t elapsed_nanos(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+struct Report {
+    std::vector<ycsb::LatencyHistogram> histograms;
+    uint64_t misses = 0;
+    double seconds = 0;
+
+    Report() : histograms(ycsb::NUM_OPERATIONS) {}
+};
+
+static void print_header() {
+    std::cout << fmt::format("{:<10} {:<16} {:>12} {:>12} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+                             "phase", "operation", "count", "ops/sec", "avg(us)", "p50(us)",
+                             "p99(us)", "p999(us)", "max(us)");
+}
+
+static void print_row(const std::string& phase, const std::string& operation,
+                      const ycsb::LatencyHistogram& histogram, double seconds) {
+    if (histogram.GetCount() == 0)
+        return;
+    double throughput = seconds > 0 ? histogram.GetCount() / seconds : 0;
+    std::cout << fmt::format(
+        "{:<10} {:<16} {:>12} {:>12.0f} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f}\n",
+        phase, operation, histogram.GetCount(), throughput, histogram.GetMean() / 1000.0,
+        histogram.Percentile(50) / 1000.0, histogram.Percentile(99) / 1000.0,
+        histogram.Percentile(99.9) / 1000.0, histogram.GetMax() / 1000.0);
+}
+
+static void print_report(const std::string& phase, const Report& report) {
+    ycsb::LatencyHistogram overall;
+    for (int operation = 0; operation < ycsb::NUM_OPERATIONS; ++operation) {
+        print_row(phase, ycsb::operation_name(operation), report.histograms[operation],
+                  report.seconds);
+        overall.Merge(report.histograms[operation]);
+    }
+    print_row(phase, "Overall", overall, report.seconds);
+    if (report.misses > 0) {
+        std::cout << fmt::format("{:<10} {} operations on missing keys\n", phase, report.misses);
+    }
+}
+
+// runs the clients, each one executing its share of the operations
+static Report run_clients(const Config& config, uint64_t num_operations,
+                          const std::function<void(size_t, uint64_t, Report&)>& client) {
+    std::vector<Report> reports(config.num_threads);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (size_t t = 0; t < config.num_threads; ++t) {
+        uint64_t share = num_operations / config.num_threads +
+                         (t < num_operations % config.num_threads ? 1 : 0);
+        threads.emplace_back([&, t, share]() { client(t, share, reports[t]); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    Report report;
+    report.seconds = elapsed_nanos(start) / 1e9;
+    for (const auto& client_report : reports) {
+        for (int operation = 0; operation < ycsb::NUM_OPERATIONS; ++operation) {
+            report.histograms[operation].Merge(client_report.histograms[operation]);
+        }
+        report.misses += client_report.misses;
+    }
+    return report;
+}
+
+static void load(const Config& config, bitcaskcpp::Bitcask& bitcsk) {
+    std::atomic<uint64_t> next_key{0};
+    Report report = run_clients(config, config.num_records, [&](size_t t, uint64_t share, Report& report) {
+        std::mt19937_64 rng(t * 7919 + 1);
+        for (uint64_t i = 0; i < share; ++i) {
+            std::string key = make_key(config, next_key.fetch_add(1));
+            std::string value = make_value(config, rng);
+            auto start = Clock::now();
+            bitcsk.Put(key.data(), value.data());
+            report.histograms[ycsb::INSERT].Record(elapsed_nanos(start));
+        }
+    });
+    print_report("load", report);
+}
+
+static void run(const Config& config, bitcaskcpp::Bitcask& bitcsk, const ycsb::Workload& workload,
+                std::atomic<uint64_t>& num_inserted) {
+    ycsb::Distribution distribution = config.distribution.empty()
+                                          ? workload.distribution
+                                          : ycsb::parse_distribution(config.distribution);
+    // the zipfian constants are linear to compute, the chooser is shared by the clients
+    const ycsb::KeyChooser chooser(distribution, config.num_records, config.zipfian_theta);
+    Report report = run_clients(config, config.num_operations, [&](size_t t, uint64_t share, Report& report) {
+        std::mt19937_64 rng(t * 104729 + 17);
+        for (uint64_t i = 0; i < share; ++i) {
+            ycsb::Operation operation = workload.Next(rng);
+            uint64_t key_number = operation == ycsb::INSERT
+                                      ? num_inserted.fetch_add(1)
+                                      : chooser.Next(rng, num_inserted.load());
+            std::string key = make_key(config, key_number);
+            std::string value;
+            if (operation == ycsb::SCAN) {
+                scan_remaining = std::uniform_int_distribution<size_t>(1, config.scan_length)(rng);
+            }
+            if (operation == ycsb::UPDATE || operation == ycsb::INSERT ||
+                operation == ycsb::READ_MODIFY_WRITE) {
+                value = make_value(config, rng);
+            }
+
+            auto start = Clock::now();
+            try {
+                switch (operation) {
+                    case ycsb::READ:
+                        bitcsk.Get(key.data());
+                        break;
+                    case ycsb::UPDATE:
+                    case ycsb::INSERT:
+                        bitcsk.Put(key.data(), value.data());
+                        break;
+                    case ycsb::SCAN:
+                        bitcsk.Scan(key.data(), count_scanned);
+                        break;
+                    case ycsb::READ_MODIFY_WRITE:
+                        bitcsk.Get(key.data());
+                        bitcsk.Put(key.data(), value.data());
+                        break;
+                    case ycsb::DELETE:
+                        bitcsk.Delete(key.data());
+                        break;
+                    default:
+                        break;
+                }
+            } catch (const bitcaskcpp::Exception&) {
+                report.misses += 1;
+            }
+            report.histograms[operation].Record(elapsed_nanos(start));
+        }
+    });
+    print_report(workload.name, report);
+}
+
+// evicts the data files of both tiers from the page cache so the next Open
+// reads from disk
+static void drop_page_cache(const fs::path& db_path, const bitcaskcpp::BitcaskOption& options) {
+    std::vector<fs::path> dirs{db_path};
+    if (!options.cold_storage_dir.empty() && fs::exists(options.cold_storage_dir)) {
+        dirs.emplace_back(options.cold_storage_dir);
+    }
+    for (const auto& dir : dirs) {
+        for (auto& entry : fs::directory_iterator(dir)) {
+            int fd = ::open(entry.path().c_str(), O_RDONLY);
+            if (fd < 0)
+                continue;
+            ::fdatasync(fd);
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    cxxopts::Options cli("ycsb", "YCSB style benchmark of the bitcask storage");
+    cli.add_options()
+        ("db", "database directory", cxxopts::value<std::string>()->default_value("ycsb-db"))
+        ("workloads", "comma separated workloads among a,b,c,d,e,f and custom",
+            cxxopts::value<std::vector<std::string>>()->default_value("a,b,c,f,d,e"))
+        ("records", "number of records loaded", cxxopts::value<uint64_t>()->default_value("1000000"))
+        ("operations", "number of operations per workload", cxxopts::value<uint64_t>()->default_value("1000000"))
+        ("threads", "number of client threads", cxxopts::value<size_t>()->default_value("4"))
+        ("distribution", "key distribution overriding the workload one: uniform, zipfian or latest",
+            cxxopts::value<std::string>()->default_value(""))
+        ("zipfian-theta", "skew of the zipfian distribution", cxxopts::value<double>()->default_value("0.99"))
+        ("key-size", "key size distribution: fixed:N, uniform:MIN-MAX or zipfian:MIN-MAX",
+            cxxopts::value<std::string>()->default_value("fixed:24"))
+        ("value-size", "value size distribution: fixed:N, uniform:MIN-MAX or zipfian:MIN-MAX",
+            cxxopts::value<std::string>()->default_value("fixed:100"))
+        ("scan-length", "maximum number of keys read by a scan, uniformly distributed",
+            cxxopts::value<size_t>()->default_value("100"))
+        ("read", "custom workload read proportion", cxxopts::value<double>()->default_value("0"))
+        ("update", "custom workload update proportion", cxxopts::value<double>()->default_value("0"))
+        ("insert", "custom workload insert proportion", cxxopts::value<double>()->default_value("0"))
+        ("scan", "custom workload scan proportion", cxxopts::value<double>()->default_value("0"))
+        ("rmw", "custom workload read-modify-write proportion", cxxopts::value<double>()->default_value("0"))
+        ("delete", "custom workload delete proportion", cxxopts::value<double>()->default_value("0"))
+        ("skip-load", "run against an already loaded database")
+        ("keep", "keep the database directory at exit")
+        ("no-compact", "skip the compaction measurement")
+        ("open-runs", "number of cold start measurements", cxxopts::value<size_t>()->default_value("3"))
+        ("io-threads", "BitcaskOption::io_threads", cxxopts::value<size_t>()->default_value("0"))
+        ("write-buffer-size", "BitcaskOption::write_buffer_size", cxxopts::value<size_t>()->default_value("0"))
+        ("direct-io", "BitcaskOption::direct_io")
+        ("max-file-size", "BitcaskOption::max_file_size", cxxopts::value<size_t>()->default_value("0"))
+        ("low-memory-keydir", "BitcaskOption::low_memory_keydir")
+        ("max-open-files", "BitcaskOption::max_open_files", cxxopts::value<size_t>()->default_value("0"))
+        ("memtable-size", "BitcaskOption::memtable_size", cxxopts::value<size_t>()->default_value("0"))
+        ("sync-writes", "BitcaskOption::sync_writes")
+        ("h,help", "print usage");
+
+    Config config;
+    std::vector<ycsb::Workload> workloads;
+    try {
+        auto result = cli.parse(argc, argv);
+        if (result.count("help")) {
+            std::cout << cli.help() << std::endl;
+            return 0;
+        }
+
+        config.db_path = result["db"].as<std::string>();
+        config.num_records = result["records"].as<uint64_t>();
+        config.num_operations = result["operations"].as<uint64_t>();
+        config.num_threads = std::max<size_t>(result["threads"].as<size_t>(), 1);
+        config.zipfian_theta = result["zipfian-theta"].as<double>();
+        config.scan_length = std::max<size_t>(result["scan-length"].as<size_t>(), 1);
+        config.distribution = result["distribution"].as<std::string>();
+        config.key_size = ycsb::SizeDistribution(result["key-size"].as<std::string>());
+        config.value_size = ycsb::SizeDistribution(result["value-size"].as<std::string>());
+        config.options.io_threads = result["io-threads"].as<size_t>();
+        config.options.write_buffer_size = result["write-buffer-size"].as<size_t>();
+        config.options.direct_io = result.count("direct-io") > 0;
+        config.options.max_file_size = result["max-file-size"].as<size_t>();
+        config.options.low_memory_keydir = result.count("low-memory-keydir") > 0;
+        config.options.max_open_files = result["max-open-files"].as<size_t>();
+        config.options.memtable_size = result["memtable-size"].as<size_t>();
+        config.options.sync_writes = result.count("sync-writes") > 0;
+        if (!config.distribution.empty()) {
+            ycsb::parse_distribution(config.distribution);
+        }
+
+        for (const auto& name : result["workloads"].as<std::vector<std::string>>()) {
+            if (name != "custom") {
+                workloads.push_back(ycsb::Workload::Preset(name));
+                continue;
+            }
+            ycsb::Workload custom{"custom", {}, ycsb::Distribution::Zipfian};
+            custom.proportions[ycsb::READ] = result["read"].as<double>();
+            custom.proportions[ycsb::UPDATE] = result["update"].as<double>();
+            custom.proportions[ycsb::INSERT] = result["insert"].as<double>();
+            custom.proportions[ycsb::SCAN] = result["scan"].as<double>();
+            custom.proportions[ycsb::READ_MODIFY_WRITE] = result["rmw"].as<double>();
+            custom.proportions[ycsb::DELETE] = result["delete"].as<double>();
+            workloads.push_back(custom);
+        }
+
+        bool skip_load = result.count("skip-load") > 0;
+        if (!skip_load && fs::exists(config.db_path)) {
+            std::cerr << "database directory already exists, remove it or pass --skip-load" << std::endl;
+            return 1;
+        }
+
+        double dataset = config.num_records * (config.key_size.Mean() + config.value_size.Mean());
+        std::cout << fmt::format("records: {}, operations: {}, threads: {}, dataset: ~{:.1f} MiB\n",
+                                 config.num_records, config.num_operations, config.num_threads,
+                                 dataset / (1 << 20));
+        print_header();
+
+        auto bitcsk = std::make_unique<bitcaskcpp::Bitcask>(config.db_path, config.options);
+        bitcsk->Open();
+        if (!skip_load) {
+            load(config, *bitcsk);
+        }
+        std::atomic<uint64_t> num_inserted{config.num_records};
+        for (const auto& workload : workloads) {
+            run(config, *bitcsk, workload, num_inserted);
+        }
+
+        ycsb::LatencyHistogram open_histogram;
+        for (size_t i = 0; i < result["open-runs"].as<size_t>(); ++i) {
+            bitcsk->Close();
+            bitcsk = std::make_unique<bitcaskcpp::Bitcask>(config.db_path, config.options);
+            drop_page_cache(config.db_path, config.options);
+            auto start = Clock::now();
+            bitcsk->Open();
+            open_histogram.Record(elapsed_nanos(start));
+        }
+        print_row("open", "Open", open_histogram, open_histogram.GetMean() * open_histogram.GetCount() / 1e9);
+
+        if (result.count("no-compact") == 0) {
+            ycsb::LatencyHistogram compact_histogram;
+            auto start = Clock::now();
+            bitcsk->Compact();
+            compact_histogram.Record(elapsed_nanos(start));
+            print_row("compact", "Compact", compact_histogram, compact_histogram.GetMax() / 1e9);
+        }
+        bitcsk->Close();
+
+        if (result.count("keep") == 0) {
+            fs::remove_all(config.db_path);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace ycsb {
+
+inline uint64_t fnv_hash64(uint64_t value) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < 8; ++i) {
+        hash ^= value & 0xff;
+        hash *= 1099511628211ULL;
+        value >>= 8;
+    }
+    return hash;
+}
+
+/*
+Zipfian distributed integers over [min, max], as generated by YCSB (Gray et al,
+"Quickly generating billion-record synthetic databases"). The zeta constant is
+computed once, which is linear in the number of items.
+*/
+class ZipfianGenerator {
+   public:
+    ZipfianGenerator(uint64_t min, uint64_t max, double theta = 0.99)
+        : base{min}, items{max - min + 1}, theta{theta} {
+        zetan = zeta(items, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1 - std::pow(2.0 / items, 1 - theta)) / (1 - zeta(2, theta) / zetan);
+        half_pow_theta = 1.0 + std::pow(0.5, theta);
+    }
+
+    template <typename Rng>
+    uint64_t Next(Rng& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0)
+            return base;
+        if (uz < half_pow_theta)
+            return base + 1;
+        uint64_t offset = static_cast<uint64_t>(items * std::pow(eta * u - eta + 1, alpha));
+        return base + std::min(offset, items - 1);
+    }
+
+   private:
+    uint64_t base;
+    uint64_t items;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+    double half_pow_theta;
+
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            sum += 1 / std::pow(i + 1, theta);
+        }
+        return sum;
+    }
+};
+
+enum class Distribution { Uniform, Zipfian, Latest };
+
+inline Distribution parse_distribution(const std::string& name) {
+    if (name == "uniform")
+        return Distribution::Uniform;
+    if (name == "zipfian")
+        return Distribution::Zipfian;
+    if (name == "latest")
+        return Distribution::Latest;
+    throw std::invalid_argument("unknown key distribution: " + name);
+}
+
+/*
+Picks the key number of the next operation among the keys inserted so far. The
+zipfian popularity is scrambled so hot keys are spread over the key space, the
+latest distribution favours the most recent inserts.
+*/
+class KeyChooser {
+   public:
+    KeyChooser(Distribution distribution, uint64_t num_records, double theta)
+        : distribution{distribution},
+          num_records{std::max<uint64_t>(num_records, 1)},
+          zipfian{0, std::max<uint64_t>(num_records, 1) - 1, theta} {}
+
+    template <typename Rng>
+    uint64_t Next(Rng& rng, uint64_t num_inserted) const {
+        num_inserted = std::max<uint64_t>(num_inserted, 1);
+        switch (distribution) {
+            case Distribution::Uniform:
+                return std::uniform_int_distribution<uint64_t>(0, num_inserted - 1)(rng);
+            case Distribution::Zipfian:
+                return fnv_hash64(zipfian.Next(rng)) % std::min(num_records, num_inserted);
+            case Distribution::Latest:
+                return num_inserted - 1 - std::min(zipfian.Next(rng), num_inserted - 1);
+        }
+        return 0;
+    }
+
+   private:
+    Distribution distribution;
+    uint64_t num_records;
+    ZipfianGenerator zipfian;
+};
+
+/*
+Size distribution of keys or values, parsed from "fixed:N", "uniform:MIN-MAX"
+or "zipfian:MIN-MAX" (small sizes being the most frequent).
+*/
+class SizeDistribution {
+   public:
+    explicit SizeDistribution(const std::string& spec) {
+        auto colon = spec.find(':');
+        std::string kind = spec.substr(0, colon);
+        std::string range = colon == std::string::npos ? "" : spec.substr(colon + 1);
+        auto dash = range.find('-');
+        try {
+            min = std::stoull(range.substr(0, dash));
+            max = dash == std::string::npos ? min : std::stoull(range.substr(dash + 1));
+        } catch (const std::logic_error&) {
+            throw std::invalid_argument("invalid size distribution: " + spec);
+        }
+        if (min == 0 || max < min)
+            throw std::invalid_argument("invalid size range: " + spec);
+
+        if (kind == "fixed") {
+            max = min;
+            distribution = Distribution::Uniform;
+        } else if (kind == "uniform" || kind == "zipfian") {
+            distribution = parse_distribution(kind);
+        } else {
+            throw std::invalid_argument("invalid size distribution: " + spec);
+        }
+        if (distribution == Distribution::Zipfian) {
+            zipfian = std::make_shared<ZipfianGenerator>(min, max);
+        }
+    }
+
+    template <typename Rng>
+    size_t Next(Rng& rng) const {
+        if (distribution == Distribution::Zipfian)
+            return zipfian->Next(rng);
+        return std::uniform_int_distribution<size_t>(min, max)(rng);
+    }
+
+    inline double Mean() const { return (min + max) / 2.0; }
+
+   private:
+    Distribution distribution;
+    size_t min;
+    size_t max;
+    std::shared_ptr<ZipfianGenerator> zipfian;
+};
+
+/*
+Latency histogram with logarithmic buckets of 64 linear sub buckets, values are
+recorded in nanoseconds with a relative error below 1.6%. Histograms are kept
+per client thread and merged when reporting.
+*/
+class LatencyHistogram {
+   public:
+    LatencyHistogram() : counts{}, count{0}, sum{0}, max{0} {}
+
+    void Record(uint64_t nanos) {
+        counts[bucket(nanos)] += 1;
+        count += 1;
+        sum += nanos;
+        max = std::max(max, nanos);
+    }
+
+    void Merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+            counts[i] += other.counts[i];
+        }
+        count += other.count;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+
+    uint64_t Percentile(double percentile) const {
+        if (count == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(std::ceil(percentile / 100.0 * count));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= std::max<uint64_t>(rank, 1))
+                return std::min(upper_bound(i), max);
+        }
+        return max;
+    }
+
+    inline uint64_t GetCount() const { return count; }
+
+    inline uint64_t GetMax() const { return max; }
+
+    inline double GetMean() const { return count == 0 ? 0 : static_cast<double>(sum) / count; }
+
+   private:
+    inline static const size_t SUB_BUCKETS = 64;
+    inline static const size_t NUM_BUCKETS = SUB_BUCKETS * 60;
+
+    std::array<uint64_t, NUM_BUCKETS> counts;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+
+    static size_t bucket(uint64_t value) {
+        if (value < SUB_BUCKETS * 2)
+            return value;
+        int shift = 63 - __builtin_clzll(value) - 6;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+    }
+
+    static uint64_t upper_bound(size_t index) {
+        if (index < SUB_BUCKETS * 2)
+            return index;
+        size_t shift = index / SUB_BUCKETS - 1;
+        uint64_t sub_bucket = index % SUB_BUCKETS + SUB_BUCKETS;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+};
+
+enum Operation { READ, UPDATE, INSERT, SCAN, READ_MODIFY_WRITE, DELETE, NUM_OPERATIONS };
+
+inline const char* operation_name(int operation) {
+    static const char* names[] = {"Get", "Put", "Insert", "Scan", "ReadModifyWrite", "Delete"};
+    return names[operation];
+}
+
+/*
+Operation mix of a workload, the core YCSB workloads are:
+  A: update heavy, 50% reads 50% updates, zipfian
+  B: read mostly, 95% reads 5% updates, zipfian
+  C: read only, zipfian
+  D: read latest, 95% reads 5% inserts, latest
+  E: short ranges, 95% scans 5% inserts, zipfian
+  F: read-modify-write, 50% reads 50% read-modify-writes, zipfian
+*/
+struct Workload {
+    std::string name;
+    std::array<double, NUM_OPERATIONS> proportions;
+    Distribution distribution;
+
+    static Workload Preset(const std::string& name) {
+        std::array<double, NUM_OPERATIONS> mix{};
+        Distribution distribution = Distribution::Zipfian;
+        if (name == "a") {
+            mix[READ] = 0.5;
+            mix[UPDATE] = 0.5;
+        } else if (name == "b") {
+            mix[READ] = 0.95;
+            mix[UPDATE] = 0.05;
+        } else if (name == "c") {
+            mix[READ] = 1.0;
+        } else if (name == "d") {
+            mix[READ] = 0.95;
+            mix[INSERT] = 0.05;
+            distribution = Distribution::Latest;
+        } else if (name == "e") {
+            mix[SCAN] = 0.95;
+            mix[INSERT] = 0.05;
+        } else if (name == "f") {
+            mix[READ] = 0.5;
+            mix[READ_MODIFY_WRITE] = 0.5;
+        } else {
+            throw std::invalid_argument("unknown workload: " + name);
+        }
+        return Workload{name, mix, distribution};
+    }
+
+    template <typename Rng>
+    Operation Next(Rng& rng) const {
+        double total = 0;
+        for (double proportion : proportions) {
+            total += proportion;
+        }
+        double pick = std::uniform_real_distribution<double>(0.0, total)(rng);
+        for (int operation = 0; operation < NUM_OPERATIONS; ++operation) {
+            if (pick < proportions[operation])
+                return static_cast<Operation>(operation);
+            pick -= proportions[operation];
+        }
+        return READ;
+    }
+};
+
+}  // namespace ycsb
@@ -12,6 +12,8 @@ show_help() {
   build         : build the app 
   run           : run the application 
   test          : run test 
+  benchmarks    : run micro benchmarks 
+  ycsb          : run ycsb workloads (ycsb --help) 
   """
 }
 
@@ -54,6 +56,10 @@ case "$1" in
     ./build/bin/benchmarks "${@:2}"
   ;;
 
+  ycsb )
+    ./build/bin/ycsb "${@:2}"
+  ;;
+
   * )
     show_help
   ;;
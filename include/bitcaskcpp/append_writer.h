@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+#include "bitcaskcpp/exception.h"
+#include "bitcaskcpp/metrics.h"
+
+namespace bitcaskcpp {
+namespace fs = std::filesystem;
+
+/*
+Appends records to a data file through a user space buffer. With direct io the
+buffer is block aligned and written with O_DIRECT, the partial tail block is
+padded on disk, kept in memory and rewritten on the next flush, the file being
+truncated back to its logical size after each flush.
+
+Records appended since the last flush are only in memory, the storage serves
+them from the buffer (see GetFlushedSize/GetBuffered). A record never straddles
+the flushed boundary.
+*/
+class AppendWriter {
+   public:
+    AppendWriter(const fs::path &file_path, size_t buffer_size, bool direct_io,
+                 IOCounters *counters = nullptr);
+    ~AppendWriter();
+
+    AppendWriter(const AppendWriter &) = delete;
+    AppendWriter &operator=(const AppendWriter &) = delete;
+
+    size_t Append(const char *data, size_t length);
+    void Flush();
+    void Sync();
+
+    inline size_t GetSize() const { return size; }
+
+    inline size_t GetFlushedSize() const { return flushed_size; }
+
+    inline const char *GetBuffered(size_t offset) const {
+        return buffer + (offset - buffer_offset);
+    }
+
+    inline int GetDescriptor() const { return fd; }
+
+    inline static const size_t BLOCK_SIZE = 4096;
+
+   private:
+    int fd;
+    bool direct_io;
+    char *buffer;
+    size_t capacity;
+    size_t buffer_offset;
+    size_t used;
+    size_t size;
+    size_t flushed_size;
+    IOCounters *counters;
+
+    void write_at(const char *data, size_t length, size_t offset);
+};
+
+}  // namespace bitcaskcpp
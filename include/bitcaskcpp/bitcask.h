@@ -1,28 +1,52 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
 #include <cstddef>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <set>
 #include <shared_mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "art/art.hpp"
+#include "bitcaskcpp/append_writer.h"
 #include "bitcaskcpp/common.h"
 #include "bitcaskcpp/exception.h"
+#include "bitcaskcpp/io_engine.h"
+#include "bitcaskcpp/manifest.h"
+#include "bitcaskcpp/metrics.h"
+#include "bitcaskcpp/sorted_index.h"
 #include "cxxutils/byteorder.h"
 
 namespace bitcaskcpp {
 namespace fs = std::filesystem;
 
+// called in key order from the start key of the scan, a non zero return stops it
 typedef int (*scan_callback_t)(std::string key, std::string value);
 
+// runs on the calling thread or on an IO thread of the storage, it may read from
+// the storage but must not close or destroy it
+typedef std::function<void(std::exception_ptr error, std::string value)> get_callback_t;
+
 /*
 +-------+--------+----------+-----+-------+--------+
 | crc32 | key_sz | value_sz | key | value | offset |
 +-------+--------+----------+-----+-------+--------+
+
+Integers are stored big endian, in hint and index files too.
 */
 struct BitcaskLayout {
     size_t base;
@@ -76,37 +100,184 @@ struct BitcaskStats {
     size_t total;
     size_t num_files;
     size_t num_entries;
+    // values held by the keydir, and the bytes they take
+    size_t num_inline_values;
+    size_t inline_memory;
 
     inline BitcaskStats(size_t disposable, size_t total, size_t num_files,
-                        size_t num_entries)
+                        size_t num_entries, size_t num_inline_values = 0,
+                        size_t inline_memory = 0)
         : disposable{disposable},
           total{total},
           num_files{num_files},
-          num_entries{num_entries} {}
+          num_entries{num_entries},
+          num_inline_values{num_inline_values},
+          inline_memory{inline_memory} {}
 };
 
 struct BitcaskEntry {
     uint64_t file_id;
     size_t record_size;
     size_t record_offset;
+    // small values are kept next to their location, length prefixed, and
+    // read without going to the file, see BitcaskOption::max_inline_value_size.
+    // Entries are handled by pointer in the keydir, copies duplicate the value
+    char *inline_value;
 
     inline BitcaskEntry(uint64_t f_id, size_t r_size, size_t r_offset)
-        : file_id{f_id}, record_size{r_size}, record_offset{r_offset} {}
+        : file_id{f_id}, record_size{r_size}, record_offset{r_offset}, inline_value{nullptr} {}
+
+    inline BitcaskEntry(const BitcaskEntry &other)
+        : file_id{other.file_id},
+          record_size{other.record_size},
+          record_offset{other.record_offset},
+          inline_value{nullptr} {
+        if (other.HasInline()) {
+            SetInline(other.inline_value + 1, other.GetInlineSize());
+        }
+    }
+
+    inline BitcaskEntry &operator=(const BitcaskEntry &other) {
+        if (this != &other) {
+            file_id = other.file_id;
+            record_size = other.record_size;
+            record_offset = other.record_offset;
+            ClearInline();
+            if (other.HasInline()) {
+                SetInline(other.inline_value + 1, other.GetInlineSize());
+            }
+        }
+        return *this;
+    }
+
+    inline ~BitcaskEntry() { ClearInline(); }
+
+    // in low memory mode deleted keys of the active file are kept in the
+    // keydir with a record size of 0, hiding older versions in sealed files
+    inline bool IsTombstone() const { return record_size == 0; }
+
+    inline bool HasInline() const { return inline_value != nullptr; }
+
+    inline size_t GetInlineSize() const { return static_cast<uint8_t>(inline_value[0]); }
+
+    inline std::string GetInline() const {
+        return std::string(inline_value + 1, GetInlineSize());
+    }
+
+    // bytes the allocator takes for the inline value, 0 without one
+    inline size_t GetInlineMemory() const {
+        return HasInline() ? GetInlineFootprint(GetInlineSize()) : 0;
+    }
+
+    // a length prefixed value plus the allocator header, rounded up to its
+    // 16 bytes steps with 32 bytes at least, as malloc does on 64 bits
+    inline static size_t GetInlineFootprint(size_t value_size) {
+        return std::max<size_t>(32, (value_size + 1 + sizeof(size_t) + 15) & ~size_t(15));
+    }
+
+    inline void SetInline(const char *value, size_t value_size) {
+        assert(value_size <= MAX_INLINE_VALUE_SIZE);
+        ClearInline();
+        inline_value = new char[value_size + 1];
+        inline_value[0] = static_cast<char>(value_size);
+        std::memcpy(inline_value + 1, value, value_size);
+    }
+
+    inline void ClearInline() {
+        delete[] inline_value;
+        inline_value = nullptr;
+    }
+
+    inline static const size_t MAX_INLINE_VALUE_SIZE = 255;
+};
+
+struct RecordLocation {
+    size_t index;
+    uint64_t file_id;
+    size_t offset;
+    size_t size;
+};
+
+// place of a record in the log, file 0 stands for the oldest file
+struct LogPosition {
+    uint64_t file_id = 0;
+    size_t offset = 0;
+
+    inline bool operator==(const LogPosition &other) const {
+        return file_id == other.file_id && offset == other.offset;
+    }
+};
+
+struct LogChange {
+    LogPosition position;
+    std::string key;
+    // nullopt for a delete
+    std::optional<std::string> value;
+};
+
+// sealed data file of a storage being replicated, see LogShipper
+struct SealedFile {
+    uint64_t file_id;
+    size_t size;
+    std::shared_ptr<FileHandle> reader;
 };
 
+class LogTail;
+struct RecordView;
+
 struct BitcaskFile {
-    std::fstream file_stream;
+    std::unique_ptr<AppendWriter> writer;
+    // pinned reader, sealed files read through the file cache have none
+    std::shared_ptr<FileHandle> reader;
     size_t total_size;
     size_t disposable_size;
-
-    BitcaskFile(fs::path file_path) {
-        file_stream.open(file_path, std::ios::binary | std::ios::in | std::ios::app |
-                                 std::ios::out);
+    bool cached;
+    // complete hint and index files, as recorded in the manifest
+    bool has_hint;
+    bool has_index;
+    bool cold;
+    // point reads since the file was opened, decide its tier on compaction
+    std::unique_ptr<std::atomic<uint64_t>> num_reads;
+
+    // opens a sealed file, or the file being appended to when writable
+    BitcaskFile(fs::path file_path, bool writable, const BitcaskOption &options,
+                IOCounters *counters = nullptr) {
+        if (writable) {
+            writer = std::make_unique<AppendWriter>(file_path, options.write_buffer_size,
+                                                    options.direct_io, counters);
+        }
+        cached = options.max_open_files > 0;
+        if (writable || !cached) {
+            reader = std::make_shared<FileHandle>(file_path, counters);
+        }
         total_size = fs::file_size(file_path);
         disposable_size = 0;
+        has_hint = false;
+        has_index = false;
+        cold = false;
+        num_reads = std::make_unique<std::atomic<uint64_t>>(0);
+    }
+
+    inline AppendWriter &GetWriter() {
+        if (writer == nullptr) {
+            throw Exception("Unable to write to a sealed bitcask file.");
+        }
+        return *writer;
     }
 
-    inline std::fstream &GetFileStream() { return file_stream; }
+    inline const std::shared_ptr<FileHandle> &GetReader() { return reader; }
+
+    // records appended since the last flush are only available in memory
+    inline bool IsBuffered(size_t offset) {
+        return writer != nullptr && offset >= writer->GetFlushedSize();
+    }
+
+    inline void Seal() {
+        writer.reset();
+        if (cached) {
+            reader.reset();
+        }
+    }
 
     inline size_t GetTotalSize() { return total_size; }
 
@@ -114,6 +285,12 @@ struct BitcaskFile {
 };
 
 class Bitcask {
+    friend class OfflineStorage;
+    friend class RecordReader;
+    friend class LogTail;
+    friend class LogShipper;
+    friend class Follower;
+
    public:
     Bitcask(std::string path, BitcaskOption options);
     ~Bitcask();
@@ -125,35 +302,144 @@ class Bitcask {
     std::string Get(const char *key);
     void Delete(const char *key);
 
+    void GetAsync(const char *key, get_callback_t callback);
+    std::future<std::string> GetFuture(const char *key);
+    std::vector<std::optional<std::string>> MultiGet(const std::vector<std::string> &keys);
+
     size_t Size() noexcept(false);
     void Scan(char *prefix, scan_callback_t func);
 
     void Sync();
     BitcaskStats Statistics();
+    // readable at any time, without taking the storage lock
+    BitcaskMetrics Metrics();
+    // why the last background memtable flush failed, empty once one succeeds
+    std::string GetFlushError();
     void Compact();
 
+    // consistent copy of the storage in an empty directory of the same file
+    // system, made of hard links to the sealed files, openable as a storage
+    void Snapshot(const std::string &path);
+
+    // follows the log from a position, see LogTail
+    std::unique_ptr<LogTail> Tail(LogPosition from = LogPosition{});
+    // position the next flushed record will be written at
+    LogPosition LogEnd();
+
    private:
     BitcaskOption options;
     fs::path storage_dir;
-    art::art<BitcaskEntry> key_dir;
+    std::unique_ptr<art::art<BitcaskEntry>> key_dir;
     std::unordered_map<uint64_t, BitcaskFile> open_files;
+    std::map<uint64_t, std::unique_ptr<SortedIndex>, std::greater<uint64_t>> sealed_indexes;
     uint64_t active_file_id;
     size_t size;
+    size_t num_inline_values;
+    size_t inline_memory;
     bool is_opened;
     std::shared_mutex mutex;
-
-    void load_data(uint64_t file_id);
+    std::unique_ptr<IOEngine> io_engine;
+    MetricsRegistry metrics;
+    FileCache file_cache;
+    // every change to the set of data files is recorded in it before it is
+    // relied upon
+    Manifest manifest;
+
+    // pending writes, nullopt marks a pending delete
+    std::unordered_map<std::string, std::optional<std::string>> memtable;
+    size_t memtable_bytes;
+    int64_t memtable_size_delta;
+    std::thread flusher;
+    std::mutex flusher_mutex;
+    std::condition_variable flusher_condition;
+    bool flusher_stopping;
+    std::string flush_error;
+
+    // tails waiting for records, woken by the writers
+    std::mutex tail_mutex;
+    std::condition_variable tail_condition;
+    uint64_t tail_sequence;
+    std::atomic<size_t> num_tails;
+    // end of the log when the last compaction started, and the file the log
+    // goes on in past its output
+    LogPosition compacted_end;
+    uint64_t compacted_next;
+
+    // files referenced by snapshots being taken, removing them is deferred
+    // until they are released, the manifest already lists them as obsolete
+    std::map<uint64_t, size_t> file_pins;
+    std::set<uint64_t> retired_files;
+
+    std::unique_lock<std::shared_mutex> lock_exclusive();
+    std::shared_lock<std::shared_mutex> lock_shared();
+
+    void load_data(const ManifestFile &manifest_file);
     void load_hint_file(uint64_t file_id);
-    std::tuple<size_t, std::string, std::string> get_value(std::istream &reader,
-                                                 size_t offset);
+    void load_index_file(uint64_t file_id);
+    void build_index(uint64_t file_id);
+    void rollover();
+    void rollover_to(uint64_t file_id);
+    void write_hint_file(uint64_t file_id);
+    void retire(uint64_t file_id);
+    void release(const std::vector<uint64_t> &file_ids);
+    void remove_file(uint64_t file_id);
+    void clear_key_dir();
+    BitcaskEntry *new_entry(uint64_t file_id, size_t record_size, size_t record_offset,
+                            const char *value, size_t value_size);
+    void free_entry(BitcaskEntry *entry);
+    void count_read(uint64_t file_id);
+    std::set<uint64_t> cold_sources();
+    // the keydir entry of a live key, or its sealed index entry copied into
+    // sealed, valid while the lock is held
+    const BitcaskEntry *lookup(const char *key, std::optional<BitcaskEntry> &sealed);
+    bool has_entry(const char *key);
+    std::optional<BitcaskEntry> find_sealed(const char *key);
+    void scan_entries(const char *from,
+                      const std::function<bool(const std::string &key,
+                                               const BitcaskEntry &entry)> &callback);
+    void set_entry(const char *key, BitcaskEntry *entry);
+    void remove_entry(const char *key, uint64_t file_id);
+    void discard(const BitcaskEntry &entry);
+    size_t copy_record(const BitcaskEntry &entry, AppendWriter &writer);
+    size_t copy_record(const RecordView &record, AppendWriter &writer);
+    // returns where the valid records end, the file size unless a torn tail
+    // of an active file is tolerated
+    size_t for_each_record(uint64_t file_id,
+                           const std::function<void(const RecordView &)> &callback,
+                           bool torn_tail = false);
     std::tuple<size_t, size_t> write_value(const char *key, const char *value);
-
-    std::string read_data(std::istream &reader, size_t offset, size_t size);
+    static void encode_record(std::string &buffer, const char *key, const char *value,
+                              size_t record_offset);
+    static void encode_hint(std::string &buffer, const std::string &key, size_t record_size,
+                            size_t record_offset);
+
+    void absorb(const char *key, std::optional<std::string> value);
+    void flush_memtable();
+    const std::optional<std::string> *find_pending(const char *key);
+    bool is_live(const char *key);
+    void start_flusher();
+    void stop_flusher();
+    void run_flusher();
+
+    void notify_tails();
+    // compacted is set when the position moved past a compaction
+    std::optional<LogChange> read_change(LogPosition &position, bool &compacted);
+    std::vector<SealedFile> sealed_files(LogPosition &end);
+    LogPosition replay(const LogChange &change);
+
+    std::string read_data(const FileHandle &reader, size_t offset, size_t size);
+    std::shared_ptr<FileHandle> file_reader(uint64_t file_id);
+
+    ReadRequest read_request(const BitcaskEntry *entry, size_t index = 0);
+    void submit(std::shared_lock<std::shared_mutex> &lock, std::vector<ReadRequest> batch,
+                batch_callback_t callback);
+    static std::string decode_value(const char *record);
+    static std::tuple<std::string, std::string> decode_record(const std::string &record);
 
     template <typename T>
-    T read(std::istream &reader, size_t offset) {
+    T read(const FileHandle &reader, size_t offset) {
         std::string buffer = read_data(reader, offset, sizeof(T));
-        return ByteOrder::fromLittleEndian<T>(buffer.data());
+        return ByteOrder::fromBigEndian<T>(buffer.data());
     }
 
     inline BitcaskFile& bitcask_file(uint64_t file_id) {
@@ -165,27 +451,55 @@ class Bitcask {
         return entry->second;
     }
 
+    // synced writes must reach the log before returning, they skip the memtable
+    inline bool absorbs_writes() const {
+        return options.memtable_size > 0 && !options.sync_writes;
+    }
+
     inline void ensure() {
         if(!is_opened) {
             throw Exception("bistcask storage is not opened yet.");
         }
     }
 
+    // data files are found in their tier through the open files
     inline fs::path data_file(uint64_t fileId) {
-        return storage_dir / (std::to_string(fileId) + DATA_FILE_EXTENTION);
+        auto entry = open_files.find(fileId);
+        return data_file(fileId, entry != open_files.end() && entry->second.cold);
+    }
+
+    inline fs::path data_file(uint64_t fileId, bool cold) {
+        if (cold && options.cold_storage_dir.empty()) {
+            throw Exception("bitcask storage has cold files but no cold storage directory.");
+        }
+        return (cold ? fs::path(options.cold_storage_dir) : storage_dir) /
+               (std::to_string(fileId) + DATA_FILE_EXTENTION);
     }
 
     inline fs::path hint_file(uint64_t fileId) {
         return storage_dir / (std::to_string(fileId) + HINT_FILE_EXTENTION);
     }
 
+    inline fs::path index_file(uint64_t fileId) {
+        return storage_dir / (std::to_string(fileId) + INDEX_FILE_EXTENTION);
+    }
+
     inline fs::path lock_file() { return storage_dir / LOCK_FILE; }
 
+    // written first then renamed over the path once complete
+    inline static fs::path temp_file(fs::path path) { return path += TEMP_FILE_EXTENTION; }
+
     inline static const char *TOMBSTONE = "BITCASKCPP_TOMBSTONE_VALUE";
     inline static const char *DATA_FILE_EXTENTION = ".data";
     inline static const char *HINT_FILE_EXTENTION = ".hint";
+    inline static const char *INDEX_FILE_EXTENTION = ".index";
     inline static const char *TEMP_FILE_EXTENTION = ".tmp";
     inline static const char *LOCK_FILE = ".lock";
+    inline static const char *SNAPSHOT_MANIFEST = "SNAPSHOT";
+    // data files are replayed and merged through buffers of this size
+    inline static const size_t REPLAY_BUFFER_SIZE = 4 << 20;
+    // first read of a tailed record, larger records take a second one
+    inline static const size_t TAIL_READ_SIZE = 4096;
 };
 
 }  // namespace bitcaskcpp
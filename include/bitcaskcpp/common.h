@@ -1,15 +1,93 @@
 #pragma once
 
+#include <cstddef>
+#include <filesystem>
 #include <string>
 
 #include "cxxutils/byteorder.h"
 
 namespace bitcaskcpp {
 
-class BitcaskOption {};
+struct BitcaskOption {
+    // number of threads serving asynchronous and batched reads, reads are
+    // executed on the calling thread when set to 0
+    size_t io_threads = 0;
+
+    // records of the same file separated by at most this many bytes are
+    // fetched by a single read in MultiGet
+    size_t multiget_coalesce_gap = 4096;
+
+    // upper bound of a single coalesced MultiGet read
+    size_t multiget_max_read_size = 1 << 20;
+
+    // size of the user space buffer accumulating appends to the active and
+    // compaction files, 0 writes every record through to the file
+    size_t write_buffer_size = 0;
+
+    // append with O_DIRECT, keeping ingest and compaction output out of the
+    // page cache, the write buffer is then at least two blocks
+    bool direct_io = false;
+
+    // the active file is sealed and a new one started once it would grow
+    // past this size, 0 disables the rollover
+    size_t max_file_size = 0;
+
+    // only the keys of the active file are kept in memory, sealed files are
+    // looked up through a sorted on disk index guarded by a bloom filter
+    bool low_memory_keydir = false;
+
+    // bloom filter size of the sealed file indexes
+    size_t bloom_bits_per_key = 10;
+
+    // fdatasync the active file after every write reaching the log
+    bool sync_writes = false;
+
+    // puts and deletes are absorbed in memory, overwrites of the same key
+    // collapse, and appended to the log in a single batch once this many
+    // bytes are pending, 0 disables the memtable. Ignored with sync_writes,
+    // every write is then appended and synced before returning
+    size_t memtable_size = 0;
+
+    // pending writes are also flushed in the background at this interval,
+    // 0 only flushes on size, Sync, Scan, Compact and Close
+    size_t memtable_flush_interval_ms = 100;
+
+    // read descriptors kept open on sealed data files, the least recently read
+    // ones are closed past this many and reopened on demand, the active file
+    // is always open, 0 keeps every file open
+    size_t max_open_files = 0;
+
+    // values of at most this many bytes, 255 at most, are also kept in the
+    // keydir so that reading them takes no disk access, 0 disables it
+    size_t max_inline_value_size = 0;
+
+    // memory the inline values may take, allocator overhead included, larger
+    // values and those written past it are read from the files
+    size_t inline_values_memory = 64 << 20;
+
+    // capacity tier directory for the data files that are rarely read, hint
+    // and index files stay in the storage directory, empty keeps every file
+    // in the storage directory
+    std::string cold_storage_dir = "";
+
+    // compaction moves the live records of the sealed files read fewer times
+    // than this since the previous compaction to the capacity tier, and those
+    // of the cold files read more often back to the fast tier
+    size_t cold_max_reads = 1;
+
+    // the newest sealed files stay on the fast tier whatever their reads
+    size_t hot_sealed_files = 2;
+
+    // time the operations into latency histograms, each timed operation reads
+    // the clock twice, io and cache counters are always collected
+    bool metrics = true;
+};
 
 uint32_t timestamp();
 
 uint32_t crc32_checksum(const char* , size_t);
 
+// fsyncs a file, or a directory for the entries created or renamed in it
+void sync_path(const std::filesystem::path &path, bool directory = false);
+
 }
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "bitcaskcpp/exception.h"
+#include "bitcaskcpp/metrics.h"
+
+namespace bitcaskcpp {
+namespace fs = std::filesystem;
+
+/*
+Read only descriptor on a data file. Handles are shared between the storage and
+the in-flight reads, so a file removed by compaction stays readable until the
+last read referencing it completes.
+*/
+class FileHandle {
+   public:
+    explicit FileHandle(const fs::path &file_path, IOCounters *counters = nullptr);
+    ~FileHandle();
+
+    FileHandle(const FileHandle &) = delete;
+    FileHandle &operator=(const FileHandle &) = delete;
+
+    void ReadAt(size_t offset, char *buffer, size_t size) const;
+    std::string ReadAt(size_t offset, size_t size) const;
+    void DropCache() const;
+
+    inline int GetDescriptor() const { return fd; }
+
+   private:
+    int fd;
+    IOCounters *counters;
+};
+
+/*
+LRU of the read handles of sealed data files, bounding the number of open
+descriptors, a miss reopens the file. An evicted handle is closed once the last
+read in flight holding it completes.
+*/
+class FileCache {
+   public:
+    FileCache(size_t capacity, IOCounters *io_counters = nullptr,
+              FileCacheCounters *counters = nullptr);
+
+    FileCache(const FileCache &) = delete;
+    FileCache &operator=(const FileCache &) = delete;
+
+    std::shared_ptr<FileHandle> Get(uint64_t file_id, const fs::path &file_path);
+    void Erase(uint64_t file_id);
+    void Clear();
+
+    inline size_t GetCapacity() const { return capacity; }
+
+   private:
+    typedef std::pair<uint64_t, std::shared_ptr<FileHandle>> entry_t;
+
+    size_t capacity;
+    IOCounters *io_counters;
+    FileCacheCounters *counters;
+    // most recently used first
+    std::list<entry_t> handles;
+    std::unordered_map<uint64_t, std::list<entry_t>::iterator> positions;
+    std::mutex mutex;
+};
+
+struct ReadRequest {
+    std::shared_ptr<FileHandle> file;
+    uint64_t file_id;
+    size_t offset;
+    size_t size;
+    size_t index;
+    std::string buffer;
+    std::exception_ptr error;
+    bool completed;
+
+    inline ReadRequest(std::shared_ptr<FileHandle> file, uint64_t file_id, size_t offset,
+                       size_t size, size_t index = 0)
+        : file{std::move(file)},
+          file_id{file_id},
+          offset{offset},
+          size{size},
+          index{index},
+          error{nullptr},
+          completed{false} {}
+
+    void Execute();
+};
+
+typedef std::function<void(std::vector<ReadRequest> &batch)> batch_callback_t;
+
+/*
+Executes batches of positional reads on a fixed pool of threads, keeping as many
+reads in flight as there are workers. A batch is sorted by (file_id, offset)
+before being dispatched so that reads on the same file hit the device in order.
+Callbacks run on the workers, they must not destroy the engine.
+*/
+class IOEngine {
+   public:
+    explicit IOEngine(size_t num_threads);
+    ~IOEngine();
+
+    IOEngine(const IOEngine &) = delete;
+    IOEngine &operator=(const IOEngine &) = delete;
+
+    void Submit(std::vector<ReadRequest> batch, batch_callback_t callback);
+
+    inline size_t GetNumThreads() const { return workers.size(); }
+
+    // whether the calling thread is one of the workers of this engine
+    bool IsWorker() const;
+
+   private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+
+    void run();
+    void enqueue(std::function<void()> task);
+};
+
+}  // namespace bitcaskcpp
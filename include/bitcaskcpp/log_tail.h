@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "bitcaskcpp/bitcask.h"
+#include "bitcaskcpp/exception.h"
+
+namespace bitcaskcpp {
+
+/*
+Follows the append log of an opened storage, yielding every record written
+after the starting position in log order: puts with their value and deletes
+with none. Records still absorbed by the memtable show up once flushed.
+
+A blocked Next is woken by the writers, there is no polling. The position of a
+change stays valid across file rotations and restarts, a compaction removes the
+files it rewrites though: a tail left at the end of the log carries on past it,
+a tail lagging behind fails and has to restart from the beginning of the log,
+which then starts with a copy of every live key.
+
+The storage must outlive its tails, Close wakes them up with an error.
+*/
+class LogTail {
+   public:
+    LogTail(Bitcask &storage, LogPosition from);
+    ~LogTail();
+
+    LogTail(const LogTail &) = delete;
+    LogTail &operator=(const LogTail &) = delete;
+
+    // next change, waiting up to timeout for one to be appended, nullopt once
+    // the timeout expired or the tail was stopped
+    std::optional<LogChange> Next(std::chrono::milliseconds timeout);
+
+    // wakes up a blocked Next, the tail yields nothing afterwards
+    void Stop();
+
+    // position following the last change returned, to resume from
+    inline LogPosition GetPosition() const { return position; }
+
+    // compactions the tail carried on past, the files before its position
+    // were rewritten by them
+    inline size_t GetNumCompactions() const { return num_compactions; }
+
+   private:
+    Bitcask &storage;
+    LogPosition position;
+    bool stopped;
+    size_t num_compactions;
+};
+
+}  // namespace bitcaskcpp
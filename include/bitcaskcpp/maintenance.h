@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bitcaskcpp/bitcask.h"
+#include "bitcaskcpp/exception.h"
+#include "bitcaskcpp/io_engine.h"
+#include "bitcaskcpp/manifest.h"
+#include "bitcaskcpp/record_reader.h"
+
+namespace bitcaskcpp {
+namespace fs = std::filesystem;
+
+struct FileVerification {
+    uint64_t file_id;
+    size_t size;
+    size_t num_records;
+    size_t num_corrupted;
+    std::optional<size_t> first_corrupted;
+    std::string error;
+
+    inline bool IsValid() const { return num_corrupted == 0 && error.empty(); }
+};
+
+struct FileUsage {
+    uint64_t file_id;
+    size_t total_size;
+    size_t live_size;
+    size_t num_live;
+    bool has_hint;
+
+    inline double Fragmentation() const {
+        return total_size == 0 ? 0.0 : 1.0 - static_cast<double>(live_size) / total_size;
+    }
+};
+
+struct HintRebuild {
+    uint64_t file_id;
+    size_t num_entries;
+    std::string error;
+};
+
+struct MergeSummary {
+    size_t num_input_files;
+    size_t input_size;
+    size_t num_keys;
+    std::vector<uint64_t> output_files;
+    size_t output_size;
+};
+
+/*
+Maintenance of a storage directory while no Bitcask has it opened, the storage
+lock is held for the lifetime of the object. Work is spread over num_threads
+threads, one data file at a time, except for the merge which splits the live
+records into num_threads output streams.
+
+Hint files written here also list the keys a file deletes, with a record size
+of 0, so that loading them hides the older versions like replaying would.
+*/
+class OfflineStorage {
+   public:
+    // the cold storage directory is needed when the storage was tiered, see
+    // BitcaskOption::cold_storage_dir. A read only storage is left as found,
+    // obsolete files stay and a storage without MANIFEST does not get one
+    explicit OfflineStorage(const fs::path &storage_dir,
+                            const fs::path &cold_storage_dir = fs::path(),
+                            bool read_only = false);
+    ~OfflineStorage();
+
+    OfflineStorage(const OfflineStorage &) = delete;
+    OfflineStorage &operator=(const OfflineStorage &) = delete;
+
+    inline const std::vector<uint64_t> &GetFileIds() const { return file_ids; }
+
+    std::vector<FileVerification> Verify(size_t num_threads);
+
+    // every record of every file, oldest first, a false return stops the walk
+    void ForEachRecord(const std::function<bool(const Record &)> &callback);
+
+    // the latest version of every live key, in key order
+    void ForEachLive(size_t num_threads, const std::function<bool(const Record &)> &callback);
+
+    // writes the hint file of the data files missing one
+    std::vector<HintRebuild> RebuildHints(size_t num_threads);
+
+    std::vector<FileUsage> Fragmentation(size_t num_threads);
+
+    // rewrites the live records into new hinted files, 0 does not split them
+    MergeSummary Merge(size_t num_threads, size_t max_file_size);
+
+   private:
+    fs::path storage_dir;
+    fs::path cold_storage_dir;
+    bool read_only;
+    Manifest manifest;
+    std::vector<uint64_t> file_ids;
+    std::map<uint64_t, ManifestFile> files;
+    uint64_t max_file_id;
+
+    std::map<std::string, BitcaskEntry> latest_entries(uint64_t file_id);
+    std::map<std::string, BitcaskEntry> build_key_dir(size_t num_threads);
+    void write_hint(uint64_t file_id, const std::map<std::string, BitcaskEntry> &entries);
+    Record read_record(const FileHandle &reader, uint64_t file_id, const BitcaskEntry &entry);
+    void ensure_writable() const;
+
+    inline fs::path data_file(uint64_t file_id) const {
+        auto file = files.find(file_id);
+        return data_file(file_id, file != files.end() && file->second.cold);
+    }
+
+    inline fs::path data_file(uint64_t file_id, bool cold) const {
+        return (cold ? cold_storage_dir : storage_dir) /
+               (std::to_string(file_id) + Bitcask::DATA_FILE_EXTENTION);
+    }
+
+    inline fs::path hint_file(uint64_t file_id) const {
+        return storage_dir / (std::to_string(file_id) + Bitcask::HINT_FILE_EXTENTION);
+    }
+
+    inline fs::path index_file(uint64_t file_id) const {
+        return storage_dir / (std::to_string(file_id) + Bitcask::INDEX_FILE_EXTENTION);
+    }
+};
+
+}  // namespace bitcaskcpp
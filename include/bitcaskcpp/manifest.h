@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bitcaskcpp/common.h"
+#include "bitcaskcpp/exception.h"
+
+namespace bitcaskcpp {
+namespace fs = std::filesystem;
+
+struct ManifestFile {
+    uint64_t file_id;
+    // known once sealed, the file being appended to is sized on open
+    size_t size;
+    bool sealed;
+    // hint and index files written completely for this data file
+    bool has_hint;
+    bool has_index;
+    // the data file lives in the cold tier directory
+    bool cold;
+};
+
+struct ManifestState {
+    // live data files in id order
+    std::map<uint64_t, ManifestFile> files;
+    // files merged away or never committed, possibly still on disk
+    std::vector<uint64_t> obsolete;
+    // ids are never reused, new files are numbered past this one
+    uint64_t max_file_id = 0;
+};
+
+/*
+Append only log of the changes to the set of data files of a storage, replayed
+on open instead of listing the directory:
+
+  add      a new data file is appended to
+  merge    a new merge output, ignored until committed
+  seal     a data file reached its final size and tier, with its hint or index
+  hints    a hint or index was written for a sealed file
+  commit   merge outputs become live, their inputs obsolete, in one edit
+  drop     a data file is obsolete
+
+Every edit is checksummed and synced, a torn edit ends the replay. The log is
+rewritten with the current state when the storage is opened. A storage without
+MANIFEST, from an older version or a snapshot, is loaded by listing its
+directory.
+*/
+class Manifest {
+   public:
+    explicit Manifest(const fs::path &storage_dir);
+    ~Manifest();
+
+    Manifest(const Manifest &) = delete;
+    Manifest &operator=(const Manifest &) = delete;
+
+    ManifestState Load();
+
+    // atomically replaces the log by the state, later edits are appended to it
+    void Rewrite(const ManifestState &state);
+    void Close();
+
+    void AddFile(uint64_t file_id);
+    void AddMergeOutput(uint64_t file_id);
+    void Seal(uint64_t file_id, size_t size, bool has_hint, bool has_index, bool cold = false);
+    void SetHints(uint64_t file_id, bool has_hint, bool has_index);
+    void CommitMerge(const std::vector<uint64_t> &outputs, const std::vector<uint64_t> &inputs);
+    void Drop(uint64_t file_id);
+
+    inline fs::path GetPath() const { return storage_dir / MANIFEST_FILE; }
+
+    inline static const char *MANIFEST_FILE = "MANIFEST";
+
+   private:
+    fs::path storage_dir;
+    int fd;
+
+    enum EditType : uint8_t { ADD = 1, MERGE = 2, SEAL = 3, HINTS = 4, COMMIT = 5, DROP = 6 };
+
+    ManifestState replay();
+    ManifestState scan();
+    void append(const std::string &edit);
+    static void encode_edit(std::string &buffer, EditType type,
+                            const std::vector<uint64_t> &fields);
+};
+
+}  // namespace bitcaskcpp
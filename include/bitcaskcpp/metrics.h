@@ -0,0 +1,187 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bitcaskcpp {
+
+inline const size_t METRICS_STRIPES = 8;
+
+// threads are spread round robin over the stripes of the counters
+inline size_t metrics_stripe() {
+    static std::atomic<size_t> next_stripe{0};
+    thread_local size_t stripe =
+        next_stripe.fetch_add(1, std::memory_order_relaxed) % METRICS_STRIPES;
+    return stripe;
+}
+
+/*
+Monotonic counter striped over cache lines, an increment is a relaxed atomic
+add on the stripe of the calling thread, reads sum up the stripes.
+*/
+class Counter {
+   public:
+    inline void Add(uint64_t n = 1) {
+        stripes[metrics_stripe()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t Value() const;
+
+   private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Stripe, METRICS_STRIPES> stripes;
+};
+
+struct HistogramSnapshot {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    std::vector<uint64_t> buckets;
+
+    HistogramSnapshot() : count{0}, sum{0}, max{0} {}
+
+    // latencies are in nanoseconds
+    uint64_t Percentile(double percentile) const;
+
+    inline double Mean() const { return count == 0 ? 0 : static_cast<double>(sum) / count; }
+};
+
+/*
+Latency histogram in nanoseconds with logarithmic buckets of 16 linear sub
+buckets (relative error below 6.25%), striped like the counters.
+*/
+class LatencyHistogram {
+   public:
+    LatencyHistogram();
+
+    void Record(uint64_t nanos);
+    HistogramSnapshot Snapshot() const;
+
+    static size_t BucketOf(uint64_t value);
+    static uint64_t UpperBound(size_t bucket);
+
+    inline static const size_t SUB_BUCKETS = 16;
+    inline static const size_t NUM_BUCKETS = SUB_BUCKETS * 61;
+
+   private:
+    struct alignas(64) Stripe {
+        std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+    };
+    // about 60KB per histogram, kept off the stack of the owning storage
+    std::unique_ptr<Stripe[]> stripes;
+    std::atomic<uint64_t> max{0};
+};
+
+struct IOCounters {
+    Counter bytes_read;
+    Counter bytes_written;
+    Counter read_calls;
+    Counter write_calls;
+    Counter sync_calls;
+};
+
+struct FileCacheCounters {
+    Counter hits;
+    Counter reopens;
+    Counter evictions;
+    std::atomic<uint64_t> open_files{0};
+};
+
+struct BitcaskMetrics {
+    // latencies per operation name (get, put, ...)
+    std::map<std::string, HistogramSnapshot> latencies;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t read_calls;
+    uint64_t write_calls;
+    uint64_t sync_calls;
+    uint64_t lock_waits;
+    uint64_t lock_wait_nanos;
+    // where record reads were served from
+    uint64_t memtable_hits;
+    uint64_t buffer_hits;
+    uint64_t inline_hits;
+    uint64_t disk_reads;
+    uint64_t bloom_checks;
+    uint64_t bloom_negatives;
+    uint64_t bloom_false_positives;
+    uint64_t compactions;
+    bool compaction_running;
+    uint64_t compaction_bytes_total;
+    uint64_t compaction_bytes_done;
+    // read descriptors of sealed files, see BitcaskOption::max_open_files
+    uint64_t file_cache_hits;
+    uint64_t file_cache_reopens;
+    uint64_t file_cache_evictions;
+    uint64_t cached_open_files;
+
+    // prometheus text exposition format, names prefixed by bitcask_
+    std::string ToPrometheus() const;
+};
+
+struct MetricsRegistry {
+    enum Operation { GET, GET_ASYNC, MULTI_GET, PUT, DELETE, SCAN, SYNC, COMPACT, NUM_OPERATIONS };
+
+    bool enabled;
+    std::array<LatencyHistogram, NUM_OPERATIONS> latencies;
+    IOCounters io;
+    Counter lock_waits;
+    Counter lock_wait_nanos;
+    Counter memtable_hits;
+    Counter buffer_hits;
+    Counter inline_hits;
+    Counter disk_reads;
+    Counter bloom_checks;
+    Counter bloom_negatives;
+    Counter bloom_false_positives;
+    Counter compactions;
+    std::atomic<bool> compaction_running{false};
+    std::atomic<uint64_t> compaction_bytes_total{0};
+    std::atomic<uint64_t> compaction_bytes_done{0};
+    FileCacheCounters file_cache;
+
+    explicit MetricsRegistry(bool enabled) : enabled{enabled} {}
+
+    BitcaskMetrics Snapshot() const;
+
+    static const char *OperationName(int operation);
+};
+
+// records the duration of an operation in its histogram when it goes out of scope
+class OperationTimer {
+   public:
+    inline OperationTimer(MetricsRegistry &registry, MetricsRegistry::Operation operation)
+        : histogram{registry.enabled ? &registry.latencies[operation] : nullptr} {
+        if (histogram != nullptr) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    inline ~OperationTimer() {
+        if (histogram != nullptr) {
+            histogram->Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count());
+        }
+    }
+
+    OperationTimer(const OperationTimer &) = delete;
+    OperationTimer &operator=(const OperationTimer &) = delete;
+
+   private:
+    LatencyHistogram *histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+}  // namespace bitcaskcpp
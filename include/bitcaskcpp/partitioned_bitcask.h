@@ -0,0 +1,195 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "bitcaskcpp/bitcask.h"
+#include "bitcaskcpp/common.h"
+#include "bitcaskcpp/exception.h"
+
+namespace bitcaskcpp {
+namespace fs = std::filesystem;
+
+struct PartitionOption {
+    // independent Bitcask instances the keys are hashed over, the count is
+    // recorded in every partition and cannot change once data is written
+    size_t num_partitions = 4;
+
+    // every partition is served by its own worker thread, the operations on
+    // a partition are queued to its worker and never contend on its lock
+    bool pin_workers = false;
+
+    // binds the worker of partition i to cpu i modulo the number of cpus
+    bool set_cpu_affinity = false;
+};
+
+/*
+Request to a partition worker, it lives in the frame of the thread waiting for
+it and is linked into the queue of the worker, so a request allocates nothing.
+*/
+class PartitionTask {
+   public:
+    PartitionTask() = default;
+    virtual ~PartitionTask() = default;
+
+    PartitionTask(const PartitionTask &) = delete;
+    PartitionTask &operator=(const PartitionTask &) = delete;
+
+    // blocks until the worker ran the task, its failure is rethrown
+    void Wait();
+
+   protected:
+    virtual void run() = 0;
+
+   private:
+    friend class PartitionWorker;
+
+    PartitionTask *next = nullptr;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool done = false;
+    std::exception_ptr error;
+
+    void execute();
+};
+
+/*
+Worker thread executing the tasks queued to it in order.
+*/
+class PartitionWorker {
+   public:
+    explicit PartitionWorker(std::optional<size_t> cpu);
+    ~PartitionWorker();
+
+    PartitionWorker(const PartitionWorker &) = delete;
+    PartitionWorker &operator=(const PartitionWorker &) = delete;
+
+    // the task must outlive its execution, see PartitionTask::Wait
+    void Enqueue(PartitionTask &task);
+
+    inline bool IsCurrent() const { return std::this_thread::get_id() == thread.get_id(); }
+
+   private:
+    std::thread thread;
+    PartitionTask *head;
+    PartitionTask *tail;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+
+    void run();
+};
+
+/*
+Shared nothing store made of num_partitions Bitcask instances, each with its
+own directory, active file, keydir, lock and compaction. A key lives in the
+partition given by a stable hash of its bytes. Partition directories are spread
+round robin over the given paths, so that several drives can be used:
+
+  <paths[i % paths.size()]>/partition-<i>
+
+Scan merges the partitions in key order, reading them by pages.
+*/
+class PartitionedBitcask {
+   public:
+    PartitionedBitcask(std::vector<std::string> paths, BitcaskOption options,
+                       PartitionOption partition_options);
+    PartitionedBitcask(std::string path, BitcaskOption options, PartitionOption partition_options);
+    ~PartitionedBitcask();
+
+    // partitions are opened, compacted and closed in parallel
+    void Open();
+    void Close();
+
+    void Put(const char *key, const char *value);
+    bool Has(const char *key);
+    std::string Get(const char *key);
+    void Delete(const char *key);
+    std::vector<std::optional<std::string>> MultiGet(const std::vector<std::string> &keys);
+
+    size_t Size();
+    void Scan(char *prefix, scan_callback_t func);
+
+    void Sync();
+    void Compact();
+
+    // sum over the partitions
+    BitcaskStats Statistics();
+    std::vector<BitcaskStats> PartitionStatistics();
+    std::vector<BitcaskMetrics> PartitionMetrics();
+
+    size_t PartitionOf(const char *key) const;
+
+    inline size_t GetNumPartitions() const { return partitions.size(); }
+
+    inline const fs::path &GetPartitionPath(size_t partition) const {
+        return partition_paths[partition];
+    }
+
+    inline static const size_t SCAN_PAGE_SIZE = 256;
+
+   private:
+    PartitionOption partition_options;
+    std::vector<fs::path> partition_paths;
+    std::vector<std::unique_ptr<Bitcask>> partitions;
+    std::vector<std::unique_ptr<PartitionWorker>> workers;
+
+    // runs task on the worker of the partition, or on the calling thread when
+    // there is no worker or the caller already is the worker
+    template <typename T, typename F>
+    T execute(size_t partition, F &&task) {
+        Bitcask &target = *partitions[partition];
+        if (workers.empty() || workers[partition]->IsCurrent()) {
+            return task(target);
+        }
+        CallTask<T, F> call(task, target);
+        workers[partition]->Enqueue(call);
+        call.Wait();
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*call.result);
+        }
+    }
+
+    template <typename T, typename F>
+    struct CallTask : PartitionTask {
+        F &task;
+        Bitcask &partition;
+        std::optional<T> result;
+
+        CallTask(F &task, Bitcask &partition) : task{task}, partition{partition} {}
+
+        void run() override { result.emplace(task(partition)); }
+    };
+
+    template <typename F>
+    struct CallTask<void, F> : PartitionTask {
+        F &task;
+        Bitcask &partition;
+
+        CallTask(F &task, Bitcask &partition) : task{task}, partition{partition} {}
+
+        void run() override { task(partition); }
+    };
+
+    // runs task on every partition, concurrently on the workers, or on a thread
+    // per partition when spawn is set, the first failure is rethrown
+    void execute_all(const std::function<void(Bitcask &, size_t)> &task, bool spawn);
+
+    void check_layout(size_t partition);
+
+    inline static const char *LAYOUT_FILE = ".partitions";
+};
+
+}  // namespace bitcaskcpp
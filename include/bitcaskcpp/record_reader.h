@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bitcaskcpp/bitcask.h"
+#include "bitcaskcpp/io_engine.h"
+
+namespace bitcaskcpp {
+namespace fs = std::filesystem;
+
+struct Record {
+    uint64_t file_id;
+    size_t offset;
+    size_t size;
+    std::string key;
+    std::string value;
+    bool tombstone;
+    // the checksum and the trailing offset of the record match its content
+    bool valid;
+};
+
+// a record decoded in place, pointing into the buffer of its reader
+struct RecordView {
+    size_t offset;
+    size_t size;
+    // the whole encoded record, header and trailing offset included
+    const char *data;
+    std::string_view key;
+    std::string_view value;
+    bool tombstone;
+    bool valid;
+};
+
+/*
+Reads the records of a data file front to back through a large buffer. Every
+complete record of the buffer is decoded and verified in one pass, refilling it
+only for the record straddling its end. Next stops at the end of the file, or
+when a record header announces more bytes than the file holds, GetError then
+describes the damage.
+*/
+class RecordReader {
+   public:
+    RecordReader(const fs::path &file_path, uint64_t file_id, size_t buffer_size = 1 << 20,
+                 IOCounters *counters = nullptr);
+
+    bool Next(Record &record);
+
+    // the views stay valid until the next call
+    bool NextBatch(std::vector<RecordView> &records);
+
+    inline const std::string &GetError() const { return error; }
+
+    inline size_t GetPosition() const { return position; }
+
+   private:
+    FileHandle reader;
+    uint64_t file_id;
+    size_t file_size;
+    // offset of the first record not decoded yet
+    size_t position;
+    std::vector<char> buffer;
+    size_t buffer_offset;
+    size_t buffer_length;
+    size_t buffer_size;
+    std::string error;
+    std::vector<RecordView> batch;
+    size_t batch_index;
+
+    size_t decode(std::vector<RecordView> &records);
+    void fill(size_t size);
+};
+
+}  // namespace bitcaskcpp
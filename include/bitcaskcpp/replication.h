@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bitcaskcpp/bitcask.h"
+#include "bitcaskcpp/exception.h"
+#include "bitcaskcpp/log_tail.h"
+
+namespace bitcaskcpp {
+
+struct ReplicaOption {
+    // an idle leader sends its log end at this interval, so that followers
+    // know how far behind they are and that the leader is alive
+    size_t heartbeat_interval_ms = 100;
+
+    // reads on a follower fail once nothing was heard from the leader for
+    // this long, 0 serves reads however stale they are
+    size_t max_staleness_ms = 0;
+};
+
+struct ReplicaStatus {
+    // end of the log applied by the follower
+    LogPosition applied;
+    // end of the log of the leader at its last heartbeat
+    LogPosition leader_end;
+    // bytes of the leader log not applied yet, when both are in the same file
+    std::optional<size_t> lag_bytes;
+    std::chrono::milliseconds since_contact;
+    size_t num_bootstraps;
+    bool connected;
+    std::string error;
+};
+
+/*
+Leader side of a replication stream, ships the log of an opened storage over a
+connected stream socket (unix or tcp) to a single Follower. The follower first
+sends the position it wants to resume from. Without one, or when a compaction
+removed it, the follower is bootstrapped: the sealed data files are streamed as
+they are on disk, then the records are tailed from the start of the active
+file. A compaction on the leader bootstraps a connected follower again, so that
+it drops the files the compaction rewrote. Records come from a LogTail, the
+leader does no extra work for reads served by the follower.
+
+  leader                       follower
+    <-- resume position ---------
+    --- reset, files, end ----->   only when bootstrapping
+    --- change | heartbeat ---->
+
+The socket is owned by the caller, Stop shuts it down. Shippers must be stopped
+before the storage is closed.
+*/
+class LogShipper {
+   public:
+    LogShipper(Bitcask &leader, int socket, ReplicaOption options = ReplicaOption{});
+    ~LogShipper();
+
+    LogShipper(const LogShipper &) = delete;
+    LogShipper &operator=(const LogShipper &) = delete;
+
+    void Start();
+    void Stop();
+
+    // reason the stream ended, empty while it runs
+    std::string GetError();
+
+   private:
+    Bitcask &leader;
+    int socket;
+    ReplicaOption options;
+    std::thread thread;
+    std::mutex mutex;
+    std::atomic<bool> stopping;
+    std::unique_ptr<LogTail> tail;
+    std::string error;
+
+    void run();
+    LogPosition send_snapshot();
+};
+
+/*
+Read only copy of a leader, fed by a LogShipper through a connected socket. The
+follower keeps its own storage directory, records are appended to the same file
+ids and offsets as on the leader, so that its log end is the position to resume
+from after a restart. Writes, compactions and scans in key order happen on the
+leader only, reads are served from the local files and keydir.
+
+Reads fail while the follower is bootstrapping, and when max_staleness_ms is
+set and the leader went silent for longer.
+*/
+class Follower {
+   public:
+    Follower(std::string path, int socket, BitcaskOption options,
+             ReplicaOption replica_options = ReplicaOption{});
+    ~Follower();
+
+    Follower(const Follower &) = delete;
+    Follower &operator=(const Follower &) = delete;
+
+    void Start();
+    void Stop();
+
+    bool Has(const char *key);
+    std::string Get(const char *key);
+    std::vector<std::optional<std::string>> MultiGet(const std::vector<std::string> &keys);
+    size_t Size();
+    void Scan(char *prefix, scan_callback_t func);
+
+    ReplicaStatus Status();
+
+    // waits until the leader log was applied up to a position, such as the
+    // LogEnd of the leader after a write
+    bool WaitFor(LogPosition position, std::chrono::milliseconds timeout);
+
+   private:
+    fs::path storage_dir;
+    int socket;
+    ReplicaOption replica_options;
+    Bitcask storage;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable applied_condition;
+    std::atomic<bool> stopping;
+    bool opened;
+    LogPosition applied;
+    LogPosition leader_end;
+    std::chrono::steady_clock::time_point last_contact;
+    size_t num_bootstraps;
+    bool connected;
+    std::string error;
+
+    void run();
+    void reset();
+    void contact(LogPosition position, bool is_heartbeat);
+    void ensure_fresh();
+};
+
+}  // namespace bitcaskcpp
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bitcaskcpp/exception.h"
+
+namespace bitcaskcpp {
+namespace fs = std::filesystem;
+
+/*
+Bloom filter over the keys of a sealed data file, a negative answer means the
+key is not in the file and its index does not need to be probed.
+*/
+class BloomFilter {
+   public:
+    BloomFilter() : num_probes{0} {}
+    BloomFilter(size_t num_keys, size_t bits_per_key);
+    BloomFilter(std::string bits, uint32_t num_probes);
+
+    void Add(std::string_view key);
+    bool MayContain(std::string_view key) const;
+
+    inline const std::string &GetBits() const { return bits; }
+
+    inline uint32_t GetNumProbes() const { return num_probes; }
+
+   private:
+    std::string bits;
+    uint32_t num_probes;
+
+    static uint64_t hash(std::string_view key);
+};
+
+struct IndexEntry {
+    std::string key;
+    size_t record_size;
+    size_t record_offset;
+    bool tombstone;
+
+    inline bool IsTombstone() const { return tombstone; }
+};
+
+/*
+Sorted index of the latest record of every key in a sealed data file, mmapped
+and binary searched, its bloom filter is loaded in memory.
+
++---------+---------+-------+--------+
+| entries | offsets | bloom | footer |
++---------+---------+-------+--------+
+entry:  | key_sz | key | record_sz | record_offset | tombstone |
+footer: | num_entries | offsets_offset | bloom_offset | bloom_sz | num_probes |
+*/
+class SortedIndex {
+   public:
+    explicit SortedIndex(const fs::path &file_path);
+    ~SortedIndex();
+
+    SortedIndex(const SortedIndex &) = delete;
+    SortedIndex &operator=(const SortedIndex &) = delete;
+
+    std::optional<IndexEntry> Find(std::string_view key) const;
+    // binary search, without checking the bloom filter
+    std::optional<IndexEntry> Search(std::string_view key) const;
+    size_t LowerBound(std::string_view key) const;
+    IndexEntry GetEntry(size_t position) const;
+
+    inline bool MayContain(std::string_view key) const { return filter.MayContain(key); }
+
+    inline size_t GetNumEntries() const { return num_entries; }
+
+    inline size_t GetFilterSize() const { return filter.GetBits().size(); }
+
+   private:
+    const char *data;
+    size_t data_size;
+    size_t num_entries;
+    const char *offsets;
+    BloomFilter filter;
+
+    std::string_view key_at(size_t position) const;
+
+    inline static const size_t FOOTER_SIZE = sizeof(size_t) * 5;
+};
+
+/*
+Streams sorted entries into a new index file, only the offsets and the bloom
+filter are kept in memory. The file is written aside and renamed by Finish so a
+partially written index is never loaded.
+*/
+class IndexBuilder {
+   public:
+    IndexBuilder(const fs::path &file_path, size_t expected_keys, size_t bits_per_key);
+
+    // entries must be added sorted by key without duplicates
+    void Add(const IndexEntry &entry);
+    void Finish();
+
+   private:
+    fs::path file_path;
+    fs::path temp_path;
+    std::ofstream writer;
+    std::string offsets;
+    size_t num_entries;
+    size_t size;
+    BloomFilter filter;
+};
+
+}  // namespace bitcaskcpp
@@ -2,8 +2,11 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <type_traits>
 
 
 /* Example
@@ -32,63 +35,80 @@ class ByteOrder {
    public:
     enum class Endianness { Little = 0, Big = 1 };
 
-    inline static Endianness endianness() {
-        const uint16_t n = 1;
-        return (n >> 8) == 0 ? Endianness::Big : Endianness::Little;
+    // the host byte order, conversions to it compile to nothing
+    inline static constexpr Endianness endianness() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return Endianness::Big;
+#else
+        return Endianness::Little;
+#endif
     }
 
     template <class T>
     static std::array<char, sizeof(T)> toLittleEndian(T v) {
-        return std::move(to_bytes<T>(v, Endianness::Little));
+        return to_bytes<T, Endianness::Little>(v);
     }
 
     template <class T>
     static std::string toLittleEndianString(T v) {
-        auto buffer = to_bytes<T>(v, Endianness::Little);
-        std::string str(buffer.begin(), buffer.end());
-        return std::move(str);
+        auto buffer = to_bytes<T, Endianness::Little>(v);
+        return std::string(buffer.begin(), buffer.end());
     }
 
     template <class T>
     static T fromLittleEndian(const char *data) {
-        return from_bytes<T>(data, Endianness::Little);
+        return from_bytes<T, Endianness::Little>(data);
     }
 
     template <class T>
     static std::array<char, sizeof(T)> toBigEndian(T v) {
-        return std::move(to_bytes<T>(v, Endianness::Big));
+        return to_bytes<T, Endianness::Big>(v);
     }
 
     template <class T>
     static std::string toBigEndianString(T v) {
-        auto buffer = to_bytes<T>(v, Endianness::Big);
-        std::string str(buffer.begin(), buffer.end());
-        return std::move(str);
+        auto buffer = to_bytes<T, Endianness::Big>(v);
+        return std::string(buffer.begin(), buffer.end());
     }
 
     template <class T>
     static T fromBigEndian(const char *data) {
-        return from_bytes<T>(data, Endianness::Big);
+        return from_bytes<T, Endianness::Big>(data);
     }
 
    private:
     template <class T>
-    static std::array<char, sizeof(T)> to_bytes(T v, enum Endianness e) {
+    static T swap(T v) {
+        if constexpr (std::is_integral<T>::value && sizeof(T) == 2) {
+            return static_cast<T>(__builtin_bswap16(static_cast<uint16_t>(v)));
+        } else if constexpr (std::is_integral<T>::value && sizeof(T) == 4) {
+            return static_cast<T>(__builtin_bswap32(static_cast<uint32_t>(v)));
+        } else if constexpr (std::is_integral<T>::value && sizeof(T) == 8) {
+            return static_cast<T>(__builtin_bswap64(static_cast<uint64_t>(v)));
+        } else {
+            char bytes[sizeof(T)];
+            std::memcpy(bytes, &v, sizeof(T));
+            std::reverse(bytes, bytes + sizeof(T));
+            std::memcpy(&v, bytes, sizeof(T));
+            return v;
+        }
+    }
+
+    template <class T, Endianness E>
+    static std::array<char, sizeof(T)> to_bytes(T v) {
         static_assert(std::is_pod<T>::value, "Expected pod type.");
+        if constexpr (E != endianness()) v = swap<T>(v);
         std::array<char, sizeof(T)> v_arrray;
         std::memcpy(v_arrray.data(), &v, sizeof(T));
-        if (e != endianness()) std::reverse(v_arrray.begin(), v_arrray.end());
-        return std::move(v_arrray);
+        return v_arrray;
     }
 
-    template <class T>
-    static T from_bytes(const char *data, enum Endianness e) {
+    template <class T, Endianness E>
+    static T from_bytes(const char *data) {
         static_assert(std::is_pod<T>::value, "Expected pod type.");
-        std::array<char, sizeof(T)> v_arrray;
-        std::memcpy(v_arrray.data(), data, sizeof(T));
-        if (e != endianness()) std::reverse(v_arrray.begin(), v_arrray.end());
         T v;
-        std::memcpy(&v, v_arrray.data(), sizeof(T));
+        std::memcpy(&v, data, sizeof(T));
+        if constexpr (E != endianness()) v = swap<T>(v);
         return v;
     }
 
@@ -0,0 +1,177 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "bitcaskcpp/append_writer.h"
+
+namespace bitcaskcpp {
+
+static size_t align_down(size_t n, size_t alignment) { return n - (n % alignment); }
+
+static size_t align_up(size_t n, size_t alignment) {
+  return align_down(n + alignment - 1, alignment);
+}
+
+AppendWriter::AppendWriter(const fs::path &file_path, size_t buffer_size,
+                           bool direct_io, IOCounters *counters)
+    : direct_io{direct_io}, buffer{nullptr}, capacity{0}, used{0},
+      counters{counters} {
+  int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+  if (direct_io) {
+    flags |= O_DIRECT;
+  }
+  fd = ::open(file_path.c_str(), flags, 0644);
+  if (fd < 0) {
+    throw Exception("Unable to open bitcask data file for writing: " +
+                    std::string(std::strerror(errno)));
+  }
+
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0) {
+    ::close(fd);
+    throw Exception("Unable to stat bitcask data file.");
+  }
+  size = file_stat.st_size;
+  flushed_size = size;
+  buffer_offset = size;
+
+  if (direct_io) {
+    // O_DIRECT transfers must be block aligned, in memory and on disk
+    capacity = align_up(std::max(buffer_size, BLOCK_SIZE * 2), BLOCK_SIZE);
+  } else {
+    capacity = buffer_size;
+  }
+  if (capacity == 0) {
+    return;
+  }
+  if (posix_memalign(reinterpret_cast<void **>(&buffer), BLOCK_SIZE, capacity) != 0) {
+    ::close(fd);
+    throw Exception("Unable to allocate bitcask write buffer.");
+  }
+
+  if (direct_io && size % BLOCK_SIZE != 0) {
+    // reload the partial tail block, it gets rewritten on the next flush
+    buffer_offset = align_down(size, BLOCK_SIZE);
+    used = size - buffer_offset;
+    ssize_t n = ::pread(fd, buffer, BLOCK_SIZE, buffer_offset);
+    if (n < static_cast<ssize_t>(used)) {
+      std::free(buffer);
+      ::close(fd);
+      throw Exception("Unable to read bitcask data file tail.");
+    }
+  }
+}
+
+AppendWriter::~AppendWriter() {
+  try {
+    Flush();
+  } catch (const Exception &) {
+  }
+  std::free(buffer);
+  ::close(fd);
+}
+
+size_t AppendWriter::Append(const char *data, size_t length) {
+  size_t offset = size;
+  if (capacity == 0) {
+    write_at(data, length, offset);
+    size += length;
+    flushed_size = size;
+    buffer_offset = size;
+    return offset;
+  }
+
+  if (used + length > capacity) {
+    Flush();
+  }
+  if (used + length <= capacity) {
+    std::memcpy(buffer + used, data, length);
+    used += length;
+    size += length;
+    return offset;
+  }
+
+  // record larger than the buffer, stream it through and flush it entirely
+  while (length > 0) {
+    size_t chunk = std::min(length, capacity - used);
+    std::memcpy(buffer + used, data, chunk);
+    used += chunk;
+    size += chunk;
+    data += chunk;
+    length -= chunk;
+    if (used == capacity) {
+      Flush();
+    }
+  }
+  Flush();
+  return offset;
+}
+
+void AppendWriter::Flush() {
+  if (size == flushed_size) {
+    return;
+  }
+
+  if (!direct_io) {
+    write_at(buffer, used, buffer_offset);
+    buffer_offset += used;
+    used = 0;
+    flushed_size = size;
+    return;
+  }
+
+  size_t length = align_up(used, BLOCK_SIZE);
+  std::memset(buffer + used, 0, length - used);
+  write_at(buffer, length, buffer_offset);
+  if (length != used && ::ftruncate(fd, size) != 0) {
+    throw Exception("Unable to truncate bitcask data file.");
+  }
+
+  // keep the partial tail block around, it is rewritten on the next flush
+  size_t tail_offset = align_down(size, BLOCK_SIZE);
+  size_t tail_size = size - tail_offset;
+  if (tail_size > 0 && tail_offset != buffer_offset) {
+    std::memmove(buffer, buffer + (tail_offset - buffer_offset), tail_size);
+  }
+  buffer_offset = tail_offset;
+  used = tail_size;
+  flushed_size = size;
+}
+
+void AppendWriter::Sync() {
+  Flush();
+  if (counters != nullptr) {
+    counters->sync_calls.Add();
+  }
+  if (::fdatasync(fd) != 0) {
+    throw Exception("Unable to sync bitcask data file.");
+  }
+}
+
+void AppendWriter::write_at(const char *data, size_t length, size_t offset) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = ::pwrite(fd, data + done, length - done, offset + done);
+    if (counters != nullptr) {
+      counters->write_calls.Add();
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      throw Exception("Unable to write to bitcask data file: " +
+                      std::string(std::strerror(errno)));
+    }
+    done += n;
+  }
+  if (counters != nullptr) {
+    counters->bytes_written.Add(length);
+  }
+}
+
+} // namespace bitcaskcpp
@@ -1,33 +1,49 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <ctime>
 #include <filesystem>
 #include <fstream>
-#include <unordered_set>
+#include <map>
+#include <queue>
 #include <iostream>
 
 #include "bitcaskcpp/bitcask.h"
+#include "bitcaskcpp/log_tail.h"
+#include "bitcaskcpp/record_reader.h"
 
 namespace bitcaskcpp {
 namespace fs = std::filesystem;
 
 Bitcask::Bitcask(std::string path, BitcaskOption options)
     : storage_dir{fs::path(path)}, options{options},
-      active_file_id{0}, size{0}, is_opened{false} {}
-
-Bitcask::~Bitcask() {}
+      key_dir{std::make_unique<art::art<BitcaskEntry>>()},
+      active_file_id{0}, size{0}, num_inline_values{0}, inline_memory{0}, is_opened{false},
+      metrics{options.metrics},
+      file_cache{options.max_open_files, &metrics.io, &metrics.file_cache},
+      manifest{fs::path(path)},
+      memtable_bytes{0}, memtable_size_delta{0}, flusher_stopping{false},
+      tail_sequence{0}, num_tails{0}, compacted_next{0} {}
+
+Bitcask::~Bitcask() {
+  stop_flusher();
+  clear_key_dir();
+}
 
 void Bitcask::Open() {
-  std::unique_lock lock(mutex);
-
-  // check if dir exist & not locked
-  // create db dir
-  bool is_new = false;
+  std::unique_lock lock = lock_exclusive();
 
   // create directry if db is new
   if (!fs::exists(storage_dir)) {
-    is_new = true;
     if (!fs::create_directory(storage_dir))
       throw Exception("Unable to create bitcask storage.");
   }
+  if (!options.cold_storage_dir.empty()) {
+    fs::create_directories(options.cold_storage_dir);
+  }
 
   // check if db is locked
   fs::path lock_file_path = storage_dir / ".lock";
@@ -41,268 +57,897 @@ void Bitcask::Open() {
   lock_file << timestamp();
   lock_file.close();
 
-  if (is_new) {
-    // create active file
-    //_currentGeneration = 1;
-    active_file_id = 1;
-    open_files.insert({active_file_id, BitcaskFile{data_file(active_file_id)}});
-    is_opened = true;
-    return;
+  if (options.io_threads > 0) {
+    io_engine = std::make_unique<IOEngine>(options.io_threads);
   }
 
-  // load all files
-  // remove any temp file
-  for (auto &p : fs::directory_iterator(storage_dir)) {
-    if (p.path().extension() == Bitcask::TEMP_FILE_EXTENTION) {
-      fs::remove(p);
+  // the live files come from the manifest, files of compactions that did not
+  // commit and inputs of those that did are removed, unless a snapshot
+  // still links them
+  ManifestState state = manifest.Load();
+  std::vector<uint64_t> obsolete = std::move(state.obsolete);
+  for (uint64_t file_id : obsolete) {
+    if (file_pins.count(file_id) == 0) {
+      remove_file(file_id);
+    } else {
+      retired_files.insert(file_id);
+      state.obsolete.push_back(file_id);
     }
+  }
 
-    if (p.path().extension() != Bitcask::DATA_FILE_EXTENTION)
-      continue;
+  // keep appending to the last file unless it was sealed
+  active_file_id = 0;
+  for (auto &[file_id, manifest_file] : state.files) {
+    fs::path file_path = data_file(file_id, manifest_file.cold);
+    if (!fs::exists(file_path)) {
+      throw Exception("Data file " + std::to_string(file_id) +
+                      " listed in the bitcask manifest is missing.");
+    }
+    // a hint or index the manifest does not list may have been cut short
+    if (!manifest_file.has_hint) {
+      fs::remove(temp_file(hint_file(file_id)));
+    }
+    if (!manifest_file.has_index) {
+      fs::remove(temp_file(index_file(file_id)));
+    }
+    if (!manifest_file.sealed && file_id == state.files.rbegin()->first) {
+      active_file_id = file_id;
+    } else if (!manifest_file.sealed) {
+      manifest_file.sealed = true;
+      manifest_file.size = fs::file_size(file_path);
+    } else if (fs::file_size(file_path) != manifest_file.size) {
+      throw Exception("Data file " + std::to_string(file_id) +
+                      " does not match the bitcask manifest.");
+    }
+  }
+  manifest.Rewrite(state);
+
+  // load records while counting disposable space, oldest file first so
+  // that records of newer files override them
+  for (const auto &[file_id, manifest_file] : state.files) {
+    load_data(manifest_file);
+    if (options.low_memory_keydir && sealed_indexes.count(file_id) == 0 &&
+        file_id != active_file_id) {
+      build_index(file_id);
+    }
+  }
 
-    // load records while counting disposable space
-    uint64_t file_id = std::stoull(p.path().stem()); // TODO execption
-    load_data(file_id);
+  if (active_file_id == 0) {
+    active_file_id = state.max_file_id + 1;
+    manifest.AddFile(active_file_id);
+    open_files.insert(
+        {active_file_id, BitcaskFile{data_file(active_file_id), true, options,
+                                     &metrics.io}});
+  } else {
+    BitcaskFile &active_file = bitcask_file(active_file_id);
+    active_file.writer = std::make_unique<AppendWriter>(
+        data_file(active_file_id), options.write_buffer_size, options.direct_io,
+        &metrics.io);
+    if (active_file.reader == nullptr) {
+      active_file.reader = std::make_shared<FileHandle>(data_file(active_file_id), &metrics.io);
+      file_cache.Erase(active_file_id);
+    }
   }
   is_opened = true;
+  start_flusher();
+}
+
+void Bitcask::start_flusher() {
+  if (!absorbs_writes() || options.memtable_flush_interval_ms == 0)
+    return;
+
+  flusher_stopping = false;
+  flusher = std::thread(&Bitcask::run_flusher, this);
+}
+
+void Bitcask::stop_flusher() {
+  {
+    std::lock_guard flusher_lock(flusher_mutex);
+    flusher_stopping = true;
+  }
+  flusher_condition.notify_all();
+  if (flusher.joinable()) {
+    flusher.join();
+  }
 }
 
 void Bitcask::Close() {
-  std::unique_lock lock(mutex);
+  {
+    // the io engine cannot join the worker running the callback
+    std::shared_lock lock = lock_shared();
+    if (io_engine != nullptr && io_engine->IsWorker()) {
+      throw Exception("Cannot close bitcask storage from an asynchronous read callback.");
+    }
+  }
+
+  // the flusher takes the storage lock, stop it before taking it
+  stop_flusher();
 
-  for (auto &[_, file] : open_files) {
-    file.GetFileStream().close();
+  std::unique_lock lock = lock_exclusive();
+  if (is_opened) {
+    flush_memtable();
   }
-  fs::remove(lock_file());
+
+  // writers flush their buffer when the files are closed
   open_files.clear();
+  file_cache.Clear();
+  sealed_indexes.clear();
+  manifest.Close();
+  fs::remove(lock_file());
+  clear_key_dir();
+  size = 0;
   is_opened = false;
+  compacted_end = LogPosition{};
+  notify_tails();
+
+  // pending async reads may call back into the storage, drain them unlocked
+  std::unique_ptr<IOEngine> engine = std::move(io_engine);
+  lock.unlock();
+  engine.reset();
 }
 
 void Bitcask::Put(const char *key, const char *value) {
   assert(key != nullptr);
   assert(value != nullptr);
-  if (value == Bitcask::TOMBSTONE) {
+  if (std::strcmp(value, Bitcask::TOMBSTONE) == 0) {
     throw Exception("The specified value is a sentinel that cannot be used in bitcask storage.");
   }
 
-  std::unique_lock lock(mutex);
+  OperationTimer timer(metrics, MetricsRegistry::PUT);
+  std::unique_lock lock = lock_exclusive();
   ensure();
 
-  bool is_new = (key_dir.get(key) == nullptr);
-  auto [record_size, record_offset] = write_value(key, value);
-  key_dir.set(key, new BitcaskEntry(active_file_id, record_size, record_offset));
-  if(is_new) {
-    size += 1;
+  if (absorbs_writes()) {
+    absorb(key, std::string(value));
+    return;
   }
+
+  auto [record_size, record_offset] = write_value(key, value);
+  set_entry(key, new_entry(active_file_id, record_size, record_offset, value, std::strlen(value)));
 }
 
 bool Bitcask::Has(const char *key) {
   assert(key != nullptr);
   
-  std::shared_lock lock(mutex);
+  std::shared_lock lock = lock_shared();
   ensure();
 
-  return key_dir.get(key) != nullptr; 
+  return is_live(key);
 }
 
 std::string Bitcask::Get(const char *key) {
   assert(key != nullptr);
   
-  std::shared_lock lock(mutex);
+  OperationTimer timer(metrics, MetricsRegistry::GET);
+  std::shared_lock lock = lock_shared();
   ensure();
 
-  BitcaskEntry *entry = key_dir.get(key);
+  const std::optional<std::string> *pending = find_pending(key);
+  if (pending != nullptr) {
+    metrics.memtable_hits.Add();
+    if (!*pending) {
+      throw Exception("Requested key not found in bistcask storage.");
+    }
+    return **pending;
+  }
+
+  std::optional<BitcaskEntry> sealed;
+  const BitcaskEntry *entry = lookup(key, sealed);
   if (entry == nullptr) {
     throw Exception("Requested key not found in bistcask storage.");
   }
+  if (entry->HasInline()) {
+    metrics.inline_hits.Add();
+    return entry->GetInline();
+  }
+  count_read(entry->file_id);
+
+  ReadRequest request = read_request(entry);
+  lock.unlock();
 
-  std::fstream& reader = bitcask_file(entry->file_id).GetFileStream();
-  auto [_, __, value] = get_value(reader, entry->record_offset);
-  return value;
+  request.Execute();
+  if (request.error) {
+    std::rethrow_exception(request.error);
+  }
+  return decode_value(request.buffer.data());
 }
 
 void Bitcask::Delete(const char *key) {
   assert(key != nullptr);
 
-  std::unique_lock lock(mutex);
+  OperationTimer timer(metrics, MetricsRegistry::DELETE);
+  std::unique_lock lock = lock_exclusive();
   ensure();
 
-  BitcaskEntry *entry = key_dir.get(key);
-  if (entry == nullptr) {
+  if (!is_live(key)) {
     throw Exception("Requested key not found in bistcask storage.");
   }
 
-  write_value(key, Bitcask::TOMBSTONE);
-  key_dir.del(key);
-  size -= 1;
+  if (absorbs_writes()) {
+    absorb(key, std::nullopt);
+    return;
+  }
+
+  auto [record_size, _] = write_value(key, Bitcask::TOMBSTONE);
+  bitcask_file(active_file_id).disposable_size += record_size;
+  remove_entry(key, active_file_id);
+}
+
+void Bitcask::GetAsync(const char *key, get_callback_t callback) {
+  assert(key != nullptr);
+  assert(callback != nullptr);
+
+  // timed until the value is handed to the callback, wherever it is read from
+  auto timer = std::make_shared<OperationTimer>(metrics, MetricsRegistry::GET_ASYNC);
+  std::shared_lock lock = lock_shared();
+  ensure();
+
+  const std::optional<std::string> *pending = find_pending(key);
+  std::optional<BitcaskEntry> sealed;
+  const BitcaskEntry *entry = nullptr;
+  if (pending == nullptr) {
+    entry = lookup(key, sealed);
+  } else if (*pending) {
+    metrics.memtable_hits.Add();
+    std::string value = **pending;
+    lock.unlock();
+    timer.reset();
+    callback(nullptr, std::move(value));
+    return;
+  }
+  if (entry == nullptr) {
+    lock.unlock();
+    timer.reset();
+    callback(std::make_exception_ptr(
+                 Exception("Requested key not found in bistcask storage.")),
+             std::string());
+    return;
+  }
+
+  if (entry->HasInline()) {
+    metrics.inline_hits.Add();
+    std::string value = entry->GetInline();
+    lock.unlock();
+    timer.reset();
+    callback(nullptr, std::move(value));
+    return;
+  }
+  count_read(entry->file_id);
+  std::vector<ReadRequest> batch;
+  batch.push_back(read_request(entry));
+  submit(lock, std::move(batch), [callback, timer](std::vector<ReadRequest> &batch) mutable {
+    ReadRequest &request = batch.front();
+    timer.reset();
+    if (request.error) {
+      callback(request.error, std::string());
+      return;
+    }
+    callback(nullptr, decode_value(request.buffer.data()));
+  });
+}
+
+std::future<std::string> Bitcask::GetFuture(const char *key) {
+  auto promise = std::make_shared<std::promise<std::string>>();
+  std::future<std::string> result = promise->get_future();
+  GetAsync(key, [promise](std::exception_ptr error, std::string value) {
+    if (error) {
+      promise->set_exception(error);
+      return;
+    }
+    promise->set_value(std::move(value));
+  });
+  return result;
+}
+
+std::vector<std::optional<std::string>>
+Bitcask::MultiGet(const std::vector<std::string> &keys) {
+  OperationTimer timer(metrics, MetricsRegistry::MULTI_GET);
+  std::shared_lock lock = lock_shared();
+  ensure();
+
+  // resolve every key under a single lock acquisition
+  std::vector<std::optional<std::string>> values(keys.size());
+  std::vector<RecordLocation> locations;
+  locations.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const std::optional<std::string> *pending = find_pending(keys[i].c_str());
+    if (pending != nullptr) {
+      metrics.memtable_hits.Add();
+      values[i] = *pending;
+      continue;
+    }
+
+    std::optional<BitcaskEntry> sealed;
+    const BitcaskEntry *entry = lookup(keys[i].c_str(), sealed);
+    if (entry == nullptr)
+      continue;
+    if (entry->HasInline()) {
+      metrics.inline_hits.Add();
+      values[i] = entry->GetInline();
+      continue;
+    }
+    count_read(entry->file_id);
+
+    BitcaskFile &file = bitcask_file(entry->file_id);
+    if (file.IsBuffered(entry->record_offset)) {
+      metrics.buffer_hits.Add();
+      values[i] = decode_value(file.GetWriter().GetBuffered(entry->record_offset));
+      continue;
+    }
+    locations.push_back({i, entry->file_id, entry->record_offset, entry->record_size});
+  }
+  metrics.disk_reads.Add(locations.size());
+  std::sort(locations.begin(), locations.end(),
+            [](const RecordLocation &a, const RecordLocation &b) {
+              return std::tie(a.file_id, a.offset) < std::tie(b.file_id, b.offset);
+            });
+
+  // merge records of the same file lying close to each other into a single
+  // read, each read remembers the range of locations it covers
+  std::vector<ReadRequest> batch;
+  std::vector<std::pair<size_t, size_t>> members;
+  for (size_t i = 0; i < locations.size(); ++i) {
+    const RecordLocation &location = locations[i];
+    if (!batch.empty()) {
+      ReadRequest &last = batch.back();
+      size_t last_end = last.offset + last.size;
+      size_t end = std::max(last_end, location.offset + location.size);
+      if (last.file_id == location.file_id &&
+          location.offset <= last_end + options.multiget_coalesce_gap &&
+          end - last.offset <= options.multiget_max_read_size) {
+        last.size = end - last.offset;
+        members.back().second = i + 1;
+        continue;
+      }
+    }
+    batch.emplace_back(file_reader(location.file_id), location.file_id,
+                       location.offset, location.size, batch.size());
+    members.push_back({i, i + 1});
+  }
+
+  // the batch is settled only once every request is done with the locations
+  // and values of this frame, the first failed read is rethrown then
+  auto done = std::make_shared<std::promise<void>>();
+  std::future<void> ready = done->get_future();
+  submit(lock, std::move(batch),
+         [&values, done, &locations, &members](std::vector<ReadRequest> &batch) {
+           std::exception_ptr error;
+           for (auto &request : batch) {
+             if (request.error) {
+               if (error == nullptr)
+                 error = request.error;
+             } else if (error == nullptr) {
+               auto [first, last] = members[request.index];
+               for (size_t i = first; i < last; ++i) {
+                 const RecordLocation &location = locations[i];
+                 values[location.index] = decode_value(
+                     request.buffer.data() + (location.offset - request.offset));
+               }
+             }
+             // files evicted from the cache are closed before returning
+             request.file.reset();
+           }
+           if (error != nullptr) {
+             done->set_exception(error);
+           } else {
+             done->set_value();
+           }
+         });
+  ready.get();
+  return values;
 }
 
 size_t Bitcask::Size() {
-  std::shared_lock lock(mutex);
+  std::shared_lock lock = lock_shared();
   ensure();
-  return size; 
+  return size + memtable_size_delta;
 }
 
 void Bitcask::Scan(char *prefix, scan_callback_t func) {
   assert(prefix != nullptr);
   assert(func != nullptr);
 
-  std::shared_lock lock(mutex);
+  OperationTimer timer(metrics, MetricsRegistry::SCAN);
+  if (absorbs_writes()) {
+    std::unique_lock lock = lock_exclusive();
+    ensure();
+    flush_memtable();
+  }
+
+  std::shared_lock lock = lock_shared();
   ensure();
   
-  for (auto it = key_dir.begin(prefix); it != key_dir.end(); ++it) {
-    std::fstream& reader = bitcask_file((*it)->file_id).GetFileStream();
-    auto [_, key, value] = get_value(reader, (*it)->record_offset);
-    func(key, value);
-  }
+  scan_entries(prefix, [&](const std::string &key, const BitcaskEntry &entry) {
+    if (entry.HasInline()) {
+      metrics.inline_hits.Add();
+      return func(key, entry.GetInline()) == 0;
+    }
+    ReadRequest request = read_request(&entry);
+    request.Execute();
+    if (request.error) {
+      std::rethrow_exception(request.error);
+    }
+    // a non zero return stops the scan
+    return func(key, decode_value(request.buffer.data())) == 0;
+  });
 }
 
 void Bitcask::Sync() {
-  std::unique_lock lock(mutex);
+  OperationTimer timer(metrics, MetricsRegistry::SYNC);
+  std::unique_lock lock = lock_exclusive();
   ensure();
 
-  std::fstream &writter = bitcask_file(active_file_id).GetFileStream();
-  writter.flush();
+  flush_memtable();
+  bitcask_file(active_file_id).GetWriter().Sync();
 }
 
 BitcaskStats Bitcask::Statistics() {
-  std::shared_lock lock(mutex);
+  std::shared_lock lock = lock_shared();
   ensure();
 
   size_t disposable = 0;
   size_t total = 0;
   size_t num_files = 0;
-  size_t num_entries = size;
+  size_t num_entries = size + memtable_size_delta;
   for (const auto &entry : open_files) {
     disposable += entry.second.disposable_size;
     total += entry.second.total_size;
     num_files++;
   }
-  return BitcaskStats(disposable, total, num_files, num_entries);
+  return BitcaskStats(disposable, total, num_files, num_entries, num_inline_values,
+                      inline_memory);
+}
+
+BitcaskMetrics Bitcask::Metrics() { return metrics.Snapshot(); }
+
+std::string Bitcask::GetFlushError() {
+  std::lock_guard flusher_lock(flusher_mutex);
+  return flush_error;
+}
+
+std::unique_lock<std::shared_mutex> Bitcask::lock_exclusive() {
+  // only contended acquisitions read the clock
+  std::unique_lock lock(mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    auto start = std::chrono::steady_clock::now();
+    lock.lock();
+    metrics.lock_waits.Add();
+    metrics.lock_wait_nanos.Add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count());
+  }
+  return lock;
+}
+
+std::shared_lock<std::shared_mutex> Bitcask::lock_shared() {
+  std::shared_lock lock(mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    auto start = std::chrono::steady_clock::now();
+    lock.lock();
+    metrics.lock_waits.Add();
+    metrics.lock_wait_nanos.Add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count());
+  }
+  return lock;
 }
 
 void Bitcask::Compact() {
-  std::unique_lock lock(mutex);
+  OperationTimer timer(metrics, MetricsRegistry::COMPACT);
+  std::unique_lock lock = lock_exclusive();
   ensure();
+  flush_memtable();
+
+  // every live record is copied, all current files become garbage
+  std::vector<uint64_t> trash_files{};
+  size_t live_size = 0;
+  for (auto &[file_id, file] : open_files) {
+    trash_files.push_back(file_id);
+    live_size += file.total_size - std::min(file.disposable_size, file.total_size);
+  }
+  std::set<uint64_t> cold_files;
+  if (!options.cold_storage_dir.empty()) {
+    cold_files = cold_sources();
+  }
+  bool tiered = !cold_files.empty();
+  BitcaskFile &active_file = bitcask_file(active_file_id);
+  compacted_end = LogPosition{active_file_id, active_file.total_size};
+  active_file.GetWriter().Sync();
+  active_file.Seal();
+  manifest.Seal(active_file_id, active_file.total_size, active_file.has_hint,
+                active_file.has_index, active_file.cold);
+  metrics.compaction_bytes_total = live_size;
+  metrics.compaction_bytes_done = 0;
+  metrics.compaction_running = true;
+  // cleared however the compaction ends, a failed one is not running anymore
+  struct RunningGuard {
+    std::atomic<bool> &running;
+    ~RunningGuard() { running = false; }
+  } running_guard{metrics.compaction_running};
+
+  // the compaction files are only live once committed, a crash before that
+  // leaves the current files in place. With a cold tier the records of the
+  // files rarely read go to a first compaction file on it, the others to a
+  // second one on the fast tier
+  struct CompactionOutput {
+    uint64_t file_id;
+    BitcaskFile *file;
+    std::unique_ptr<IndexBuilder> index;
+    std::ofstream hint_writer;
+  };
+  std::vector<CompactionOutput> outputs(tiered ? 2 : 1);
+  uint64_t first_output_id = active_file_id + 1;
+  active_file_id += outputs.size() + 1;
+  compacted_next = active_file_id;
+  manifest.AddFile(active_file_id);
+  open_files.insert(
+      {active_file_id, BitcaskFile{data_file(active_file_id), true, options,
+                                   &metrics.io}});
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    CompactionOutput &output = outputs[i];
+    output.file_id = first_output_id + i;
+    bool cold = tiered && i == 0;
+    manifest.AddMergeOutput(output.file_id);
+    auto [opened, _] = open_files.insert(
+        {output.file_id, BitcaskFile{data_file(output.file_id, cold), true, options,
+                                     &metrics.io}});
+    output.file = &opened->second;
+    output.file->cold = cold;
+    if (options.low_memory_keydir) {
+      output.index = std::make_unique<IndexBuilder>(index_file(output.file_id), size,
+                                                    options.bloom_bits_per_key);
+    } else {
+      output.hint_writer.open(hint_file(output.file_id),
+                              std::ios::binary | std::ios::out | std::ios::trunc);
+    }
+  }
+  auto output_of = [&](uint64_t file_id) -> CompactionOutput & {
+    return cold_files.count(file_id) > 0 ? outputs.front() : outputs.back();
+  };
+
+  if (options.low_memory_keydir) {
+    // stream every live key, in order, into the index of its compaction file
+    scan_entries("", [&](const std::string &key, const BitcaskEntry &entry) {
+      CompactionOutput &output = output_of(entry.file_id);
+      size_t record_offset = copy_record(entry, output.file->GetWriter());
+      output.index->Add(IndexEntry{key, entry.record_size, record_offset, false});
+      return true;
+    });
+    clear_key_dir();
+    sealed_indexes.clear();
+    for (CompactionOutput &output : outputs) {
+      output.index->Finish();
+      output.file->has_index = true;
+      sealed_indexes.emplace(output.file_id,
+                             std::make_unique<SortedIndex>(index_file(output.file_id)));
+    }
+  } else {
+    // copy the live records file by file, each input is read sequentially
+    // and a record is live when the keydir still points at it
+    std::vector<RecordView> records;
+    std::string key;
+    for (uint64_t file_id : trash_files) {
+      CompactionOutput &output = output_of(file_id);
+      RecordReader reader(data_file(file_id), file_id, REPLAY_BUFFER_SIZE, &metrics.io);
+      while (reader.NextBatch(records)) {
+        for (const RecordView &record : records) {
+          key.assign(record.key);
+          BitcaskEntry *entry = key_dir->get(key.data());
+          if (entry == nullptr || entry->file_id != file_id ||
+              entry->record_offset != record.offset)
+            continue;
+          if (!record.valid) {
+            throw Exception("Corrupted record in data file " + std::to_string(file_id) +
+                            " at offset " + std::to_string(record.offset));
+          }
+          size_t record_offset = copy_record(record, output.file->GetWriter());
+          entry->file_id = output.file_id;
+          entry->record_offset = record_offset;
+
+          // create hint_file entry
+          std::string buffer;
+          encode_hint(buffer, key, entry->record_size, record_offset);
+          output.hint_writer.write(buffer.data(), buffer.length());
+        }
+      }
+      if (!reader.GetError().empty()) {
+        throw Exception("Corrupted data file " + std::to_string(file_id) + ": " +
+                        reader.GetError());
+      }
+    }
+    // sync & close hint files;
+    for (CompactionOutput &output : outputs) {
+      output.hint_writer.close();
+      if (output.hint_writer.fail()) {
+        throw Exception("Unable to write hint file " + std::to_string(output.file_id));
+      }
+      sync_path(hint_file(output.file_id));
+      output.file->has_hint = true;
+    }
+  }
 
-  active_file_id += 2;
-  uint64_t compation_file_id = active_file_id - 1;
-  BitcaskFile active_file{data_file(active_file_id)};
-  open_files.insert({active_file_id, std::move(active_file)});
-
-  // loop through all keys in key_dir
-  std::unordered_set<uint64_t> trash_files{};
-  BitcaskFile compaction_file{data_file(compation_file_id)};
-  open_files.insert({compation_file_id, std::move(compaction_file)});
-  std::fstream &writer = bitcask_file(compation_file_id).GetFileStream();
-  writer.seekp(0, std::ios_base::beg);
-
-  // create hint file
-  std::fstream hint_writer;
-  hint_writer.open(hint_file(compation_file_id),
-                   std::ios::binary | std::ios::out | std::ios::app);
-  hint_writer.seekg(0, std::ios_base::end);
-
-  for (const auto entry : key_dir) {
-    trash_files.insert(entry->file_id);
-
-    size_t record_offset = writer.tellp();
-    std::fstream &reader = bitcask_file(entry->file_id).GetFileStream();
-    reader.seekg(entry->record_offset, std::ios_base::beg);
-    std::string buffer(entry->record_size, '\0');
-    reader.read(buffer.data(), buffer.length());
-    writer.write(buffer.data(), buffer.length());
-
-    entry->file_id = compation_file_id;
-    entry->record_offset = record_offset;
-
-    // create hint_file entry
-    // TODO: try to make key available via iterator, it's realy annoying that we
-    // have to read this via disk data
-    // https://github.com/rafaelkallis/adaptive-radix-tree/issues/9
-    std::stringstream data_reader;
-    data_reader.str(buffer.data());
-    auto [_, key, __] = get_value(data_reader, 0);
-    size_t key_size = key.length();
-    size_t record_size = buffer.length();
-
-    buffer.resize(BitcaskLayout::GetHintRecordSize(key_size), '\0');
-    buffer.append(ByteOrder::toLittleEndianString<size_t>(key_size));
-    buffer.append(key);
-    buffer.append(ByteOrder::toLittleEndianString<size_t>(record_size));
-    buffer.append(ByteOrder::toLittleEndianString<size_t>(record_offset));
-    hint_writer.write(buffer.data(), buffer.length());
-  }
-  // sync & close hint file;
-  hint_writer.close();
-
-  // remove unused files
+  // the compaction files are durable, entries included, before the manifest
+  // commits them
+  sync_path(storage_dir, true);
+  if (tiered) {
+    sync_path(options.cold_storage_dir, true);
+  }
+
+  std::vector<uint64_t> output_ids;
+  for (CompactionOutput &output : outputs) {
+    BitcaskFile &compaction_file = *output.file;
+    compaction_file.GetWriter().Sync();
+    compaction_file.Seal();
+    compaction_file.total_size = fs::file_size(data_file(output.file_id));
+    manifest.Seal(output.file_id, compaction_file.total_size, compaction_file.has_hint,
+                  compaction_file.has_index, compaction_file.cold);
+    output_ids.push_back(output.file_id);
+  }
+  manifest.CommitMerge(output_ids, trash_files);
+
+  // remove unused files, dropping their pages from the cache first as reads
+  // in flight may keep them alive for a while
   for (const auto file_id : trash_files) {
+    file_reader(file_id)->DropCache();
+    file_cache.Erase(file_id);
     open_files.erase(file_id);
-    fs::remove(data_file(file_id));
-    fs::remove(hint_file(file_id));
+    retire(file_id);
   }
+  metrics.compactions.Add();
+  notify_tails();
 }
 
-void Bitcask::load_data(uint64_t file_id) {
-  // wlock
-  BitcaskFile file(this->data_file(file_id));
-  open_files.insert({file_id, std::move(file)});
-  if (fs::exists(hint_file(file_id))) {
-    // load binary hint file
-    this->load_hint_file(file_id);
-    return;
+void Bitcask::Snapshot(const std::string &path) {
+  fs::path target(path);
+  std::vector<uint64_t> file_ids;
+  std::vector<size_t> file_sizes;
+  std::vector<fs::path> data_paths;
+  {
+    std::unique_lock lock = lock_exclusive();
+    ensure();
+    if (fs::exists(target) && !fs::is_empty(target)) {
+      throw Exception("The snapshot directory is not empty.");
+    }
+
+    // every write so far ends up in a sealed file
+    flush_memtable();
+    BitcaskFile &active_file = bitcask_file(active_file_id);
+    if (active_file.total_size > 0) {
+      active_file.GetWriter().Sync();
+      rollover();
+    }
+
+    std::map<uint64_t, size_t> sealed;
+    for (const auto &[file_id, file] : open_files) {
+      if (file_id != active_file_id) {
+        sealed.emplace(file_id, file.total_size);
+      }
+    }
+    for (const auto &[file_id, file_size] : sealed) {
+      file_ids.push_back(file_id);
+      file_sizes.push_back(file_size);
+      data_paths.push_back(data_file(file_id));
+      file_pins[file_id] += 1;
+    }
+
+    // the newest file needs a hint or an index, or opening the snapshot would
+    // append to it, and through the link to the file of this storage
+    if (!file_ids.empty() && !bitcask_file(file_ids.back()).has_hint &&
+        !bitcask_file(file_ids.back()).has_index) {
+      try {
+        write_hint_file(file_ids.back());
+      } catch (...) {
+        release(file_ids);
+        throw;
+      }
+    }
   }
 
-  // load file manually by replaying the log
-  BitcaskFile& btcsk_file = bitcask_file(file_id); 
-  std::fstream &reader = btcsk_file.GetFileStream();
-  reader.seekg(0, std::ios_base::end);
-  size_t file_size = reader.tellp();
-  btcsk_file.total_size = file_size;
+  // sealed files never change, they are linked while the storage goes on,
+  // those of the cold tier next to the others
+  try {
+    fs::create_directories(target);
+    std::string manifest = "bitcaskcpp snapshot " + std::to_string(timestamp()) + "\n";
+    for (size_t i = 0; i < file_ids.size(); ++i) {
+      for (const fs::path &file_path :
+           {data_paths[i], hint_file(file_ids[i]), index_file(file_ids[i])}) {
+        if (!fs::exists(file_path))
+          continue;
+        fs::create_hard_link(file_path, target / file_path.filename());
+        sync_path(file_path);
+      }
+      manifest += std::to_string(file_ids[i]) + " " + std::to_string(file_sizes[i]) + "\n";
+    }
 
-  // traverse from end of file
-  std::unordered_set<char *> processed_keys{};
-  size_t record_offset = read<size_t>(reader, file_size - sizeof(size_t));
-  size_t disposable_size = 0;
-  while (true) {
-    auto [record_size, key, value] = get_value(reader, record_offset);
-    if (processed_keys.find(key.data()) == processed_keys.end()) {
-      if (record_offset == 0)
-        break;
-      record_offset = read<size_t>(reader, record_offset - sizeof(size_t));
-      continue;
+    fs::path manifest_path = target / SNAPSHOT_MANIFEST;
+    std::ofstream writer(manifest_path, std::ios::out | std::ios::trunc);
+    writer << manifest;
+    writer.close();
+    if (writer.fail()) {
+      throw Exception("Unable to write the snapshot manifest.");
     }
-    processed_keys.insert(key.data());
+    sync_path(manifest_path);
+    sync_path(target, true);
+  } catch (const fs::filesystem_error &e) {
+    std::unique_lock lock = lock_exclusive();
+    release(file_ids);
+    throw Exception("Unable to link the snapshot files: " + std::string(e.what()));
+  } catch (...) {
+    std::unique_lock lock = lock_exclusive();
+    release(file_ids);
+    throw;
+  }
 
-    if (value == Bitcask::TOMBSTONE) {
-      disposable_size += record_size;
-      if (record_offset == 0)
-        break;
-      record_offset = read<size_t>(reader, record_offset - sizeof(size_t));
+  std::unique_lock lock = lock_exclusive();
+  release(file_ids);
+}
+
+void Bitcask::write_hint_file(uint64_t file_id) {
+  // latest record of every key in the file, a record size of 0 for deletions
+  std::map<std::string, std::pair<size_t, size_t>> entries;
+  for_each_record(file_id, [&](const RecordView &record) {
+    entries[std::string(record.key)] = {record.tombstone ? 0 : record.size, record.offset};
+  });
+
+  fs::path temp_path = temp_file(hint_file(file_id));
+  std::ofstream writer(temp_path, std::ios::binary | std::ios::out | std::ios::trunc);
+  std::string buffer;
+  for (const auto &[key, entry] : entries) {
+    encode_hint(buffer, key, entry.first, entry.second);
+  }
+  writer.write(buffer.data(), buffer.length());
+  writer.close();
+  if (writer.fail()) {
+    throw Exception("Unable to write hint file " + std::to_string(file_id));
+  }
+  sync_path(temp_path);
+  fs::rename(temp_path, hint_file(file_id));
+  sync_path(storage_dir, true);
+  BitcaskFile &btcsk_file = bitcask_file(file_id);
+  btcsk_file.has_hint = true;
+  manifest.SetHints(file_id, true, btcsk_file.has_index);
+}
+
+void Bitcask::retire(uint64_t file_id) {
+  if (file_pins.count(file_id) == 0) {
+    remove_file(file_id);
+    return;
+  }
+  retired_files.insert(file_id);
+}
+
+void Bitcask::release(const std::vector<uint64_t> &file_ids) {
+  for (uint64_t file_id : file_ids) {
+    auto pin = file_pins.find(file_id);
+    if (pin == file_pins.end() || --pin->second > 0)
       continue;
+    file_pins.erase(pin);
+    if (retired_files.erase(file_id) > 0) {
+      remove_file(file_id);
     }
+  }
+}
 
-    key_dir.set(key.data(), new BitcaskEntry(file_id, record_size, record_offset));
-    if (record_offset == 0)
-      break;
-    record_offset = read<size_t>(reader, record_offset - sizeof(size_t));
+void Bitcask::remove_file(uint64_t file_id) {
+  fs::remove(data_file(file_id, false));
+  if (!options.cold_storage_dir.empty()) {
+    fs::remove(data_file(file_id, true));
+  }
+  fs::remove(hint_file(file_id));
+  fs::remove(index_file(file_id));
+  fs::remove(temp_file(hint_file(file_id)));
+  fs::remove(temp_file(index_file(file_id)));
+}
+
+std::unique_ptr<LogTail> Bitcask::Tail(LogPosition from) {
+  return std::make_unique<LogTail>(*this, from);
+}
+
+LogPosition Bitcask::LogEnd() {
+  std::shared_lock lock = lock_shared();
+  ensure();
+  return LogPosition{active_file_id, bitcask_file(active_file_id).total_size};
+}
+
+void Bitcask::load_data(const ManifestFile &manifest_file) {
+  uint64_t file_id = manifest_file.file_id;
+  auto [opened, _] = open_files.insert(
+      {file_id, BitcaskFile{data_file(file_id, manifest_file.cold), false, options, &metrics.io}});
+  opened->second.has_hint = manifest_file.has_hint;
+  opened->second.has_index = manifest_file.has_index;
+  opened->second.cold = manifest_file.cold;
+  if (options.low_memory_keydir && manifest_file.has_index) {
+    this->load_index_file(file_id);
+    return;
+  }
+
+  if (manifest_file.has_hint) {
+    // load binary hint file
+    this->load_hint_file(file_id);
+    return;
   }
 
-  btcsk_file.disposable_size = disposable_size;
+  // load file manually by replaying the log, front to back through a large
+  // buffer so that later records of a key override earlier ones
+  BitcaskFile& btcsk_file = bitcask_file(file_id);
+  if (btcsk_file.total_size == 0)
+    return;
+
+  // a crash may tear the last appends to the active file, or leave the zero
+  // padding of a direct io flush behind them, the log ends before those
+  std::string key;
+  size_t valid_size = for_each_record(
+      file_id,
+      [&](const RecordView &record) {
+        key.assign(record.key);
+        if (record.tombstone) {
+          btcsk_file.disposable_size += record.size;
+          if (has_entry(key.data())) {
+            remove_entry(key.data(), file_id);
+          }
+        } else {
+          set_entry(key.data(), new_entry(file_id, record.size, record.offset,
+                                          record.value.data(), record.value.size()));
+        }
+      },
+      !manifest_file.sealed);
+  if (valid_size < btcsk_file.total_size) {
+    fs::resize_file(data_file(file_id), valid_size);
+    sync_path(data_file(file_id));
+    btcsk_file.total_size = valid_size;
+  }
+}
+
+// whether a file holds nothing but zeros from an offset on
+static bool zeroed_from(const fs::path &file_path, size_t offset) {
+  FileHandle reader(file_path);
+  size_t file_size = fs::file_size(file_path);
+  while (offset < file_size) {
+    std::string chunk = reader.ReadAt(offset, std::min<size_t>(file_size - offset, 1 << 20));
+    if (std::any_of(chunk.begin(), chunk.end(), [](char c) { return c != 0; }))
+      return false;
+    offset += chunk.length();
+  }
+  return true;
+}
+
+size_t Bitcask::for_each_record(uint64_t file_id,
+                                const std::function<void(const RecordView &)> &callback,
+                                bool torn_tail) {
+  // records are decoded and checksummed a buffer at a time, a damaged record
+  // stops the caller as a read error would. A crash only tears the end of the
+  // log, a partial last record or the zero padding of a direct io flush,
+  // damage followed by more data is corruption
+  fs::path file_path = data_file(file_id);
+  RecordReader reader(file_path, file_id, REPLAY_BUFFER_SIZE, &metrics.io);
+  std::vector<RecordView> records;
+  while (reader.NextBatch(records)) {
+    for (const RecordView &record : records) {
+      if (!record.valid) {
+        if (torn_tail && (record.offset + record.size == fs::file_size(file_path) ||
+                          zeroed_from(file_path, record.offset)))
+          return record.offset;
+        throw Exception("Corrupted record in data file " + std::to_string(file_id) +
+                        " at offset " + std::to_string(record.offset));
+      }
+      callback(record);
+    }
+  }
+  // the header of the last record announces more than the file holds
+  if (!reader.GetError().empty() && !torn_tail) {
+    throw Exception("Corrupted data file " + std::to_string(file_id) + ": " + reader.GetError());
+  }
+  return reader.GetPosition();
 }
 
 void Bitcask::load_hint_file(uint64_t file_id) {
-  std::fstream reader;
-  reader.open(data_file(file_id),
-              std::ios::binary | std::ios::in | std::ios::app);
-  reader.seekg(0, std::ios_base::end);
-  size_t total_size = reader.tellg();
-  reader.seekg(0, std::ios_base::beg);
+  FileHandle reader(hint_file(file_id));
+  size_t total_size = fs::file_size(hint_file(file_id));
   size_t offset = 0;
+  size_t live_size = 0;
 
   // traverse hint file forward
-  while (offset <= total_size) {
+  while (offset < total_size) {
     BitcaskLayout layout(offset);
     size_t key_size = read<size_t>(reader, layout.GetHintKeySizeOffset());
     std::string key = read_data(reader, layout.GetHintKeyOffset(), key_size);
@@ -310,59 +955,699 @@ void Bitcask::load_hint_file(uint64_t file_id) {
         read<size_t>(reader, layout.GetHintRecordSizeOffset(key_size));
     size_t record_offset =
         read<size_t>(reader, layout.GetHintRecordOffsetOffset(key_size));
-    key_dir.set(key.data(),
-                new BitcaskEntry(file_id, record_size, record_offset));
     offset += BitcaskLayout::GetHintRecordSize(key_size);
+
+    // a record size of 0 marks a key deleted by this file
+    if (record_size == 0) {
+      if (has_entry(key.data())) {
+        remove_entry(key.data(), file_id);
+      }
+      continue;
+    }
+    set_entry(key.data(), new BitcaskEntry(file_id, record_size, record_offset));
+    live_size += record_size;
   }
+
+  // whatever the hint does not reference is an older version or a tombstone
+  BitcaskFile &btcsk_file = bitcask_file(file_id);
+  btcsk_file.disposable_size += btcsk_file.total_size - std::min(live_size, btcsk_file.total_size);
 }
 
-std::tuple<size_t, std::string, std::string> Bitcask::get_value(std::istream &reader,
-                                                      size_t offset) {
-  BitcaskLayout layout(offset);
+void Bitcask::load_index_file(uint64_t file_id) {
+  auto index = std::make_unique<SortedIndex>(index_file(file_id));
+  BitcaskFile &btcsk_file = bitcask_file(file_id);
 
-  uint32_t checksum = read<uint32_t>(reader, layout.GetChecksumOffset());
-  size_t key_size = read<size_t>(reader, layout.GetKeySizeOffset());
-  size_t value_size = read<size_t>(reader, layout.GetValueSizeOffset());
+  // older indexes are all loaded, account for the records this file shadows
+  for (size_t i = 0; i < index->GetNumEntries(); ++i) {
+    IndexEntry entry = index->GetEntry(i);
+    std::optional<BitcaskEntry> previous = find_sealed(entry.key.c_str());
+    if (previous) {
+      discard(*previous);
+    }
+    if (entry.IsTombstone()) {
+      btcsk_file.disposable_size += entry.record_size;
+      size -= previous ? 1 : 0;
+    } else {
+      size += previous ? 0 : 1;
+    }
+  }
+  sealed_indexes.emplace(file_id, std::move(index));
+}
 
-  std::string key = read_data(reader, layout.GetKeyOffset(), key_size);
-  std::string value = read_data(reader, layout.GetValueOffset(key_size), value_size);
-  size_t record_size = BitcaskLayout::GetRecordSize(key_size, value_size);
+void Bitcask::build_index(uint64_t file_id) {
+  BitcaskFile &btcsk_file = bitcask_file(file_id);
+
+  // latest record of every key in the file, deletions included
+  std::map<std::string, IndexEntry> entries;
+  for_each_record(file_id, [&](const RecordView &record) {
+    std::string key(record.key);
+    entries[key] = IndexEntry{key, record.size, record.offset, record.tombstone};
+  });
+
+  IndexBuilder index(index_file(file_id), entries.size(), options.bloom_bits_per_key);
+  for (const auto &[_, entry] : entries) {
+    index.Add(entry);
+  }
+  index.Finish();
+  sealed_indexes.emplace(file_id, std::make_unique<SortedIndex>(index_file(file_id)));
+  btcsk_file.has_index = true;
+  manifest.SetHints(file_id, btcsk_file.has_hint, true);
+
+  // the keydir only keeps the entries of the active file
+  for (const auto &[key, _] : entries) {
+    BitcaskEntry *entry = key_dir->get(key.c_str());
+    if (entry != nullptr && entry->file_id == file_id) {
+      free_entry(key_dir->del(key.c_str()));
+    }
+  }
+}
+
+void Bitcask::rollover() { rollover_to(active_file_id + 1); }
+
+void Bitcask::rollover_to(uint64_t file_id) {
+  BitcaskFile &active_file = bitcask_file(active_file_id);
+  if (active_file.total_size == 0) {
+    // nothing to seal, a follower skipping ahead drops its empty file
+    manifest.Drop(active_file_id);
+    open_files.erase(active_file_id);
+    file_cache.Erase(active_file_id);
+    fs::remove(data_file(active_file_id));
+  } else {
+    // the size recorded in the manifest must be on disk
+    active_file.GetWriter().Sync();
+    active_file.Seal();
+    manifest.Seal(active_file_id, active_file.total_size, active_file.has_hint,
+                  active_file.has_index);
+    if (options.low_memory_keydir) {
+      build_index(active_file_id);
+    }
+  }
+
+  manifest.AddFile(file_id);
+  active_file_id = file_id;
+  open_files.insert(
+      {active_file_id, BitcaskFile{data_file(active_file_id), true, options,
+                                   &metrics.io}});
+}
 
-  return std::make_tuple(record_size, key, value);
+void Bitcask::count_read(uint64_t file_id) {
+  if (!options.cold_storage_dir.empty()) {
+    bitcask_file(file_id).num_reads->fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+std::set<uint64_t> Bitcask::cold_sources() {
+  // the active file and the newest sealed ones hold recent writes, the
+  // others are judged on their reads
+  std::vector<uint64_t> sealed;
+  for (const auto &[file_id, _] : open_files) {
+    if (file_id != active_file_id) {
+      sealed.push_back(file_id);
+    }
+  }
+  std::sort(sealed.begin(), sealed.end(), std::greater<uint64_t>());
+
+  std::set<uint64_t> sources;
+  for (size_t i = std::min(options.hot_sealed_files, sealed.size()); i < sealed.size(); ++i) {
+    if (bitcask_file(sealed[i]).num_reads->load(std::memory_order_relaxed) <
+        options.cold_max_reads) {
+      sources.insert(sealed[i]);
+    }
+  }
+  return sources;
+}
+
+void Bitcask::clear_key_dir() {
+  for (auto entry : *key_dir) {
+    delete entry;
+  }
+  key_dir = std::make_unique<art::art<BitcaskEntry>>();
+  num_inline_values = 0;
+  inline_memory = 0;
+}
+
+BitcaskEntry *Bitcask::new_entry(uint64_t file_id, size_t record_size, size_t record_offset,
+                                 const char *value, size_t value_size) {
+  auto entry = new BitcaskEntry(file_id, record_size, record_offset);
+  size_t max_size = std::min(options.max_inline_value_size, BitcaskEntry::MAX_INLINE_VALUE_SIZE);
+  if (value_size <= max_size &&
+      inline_memory + BitcaskEntry::GetInlineFootprint(value_size) <=
+          options.inline_values_memory) {
+    entry->SetInline(value, value_size);
+    num_inline_values += 1;
+    inline_memory += entry->GetInlineMemory();
+  }
+  return entry;
+}
+
+void Bitcask::free_entry(BitcaskEntry *entry) {
+  if (entry->HasInline()) {
+    num_inline_values -= 1;
+    inline_memory -= entry->GetInlineMemory();
+  }
+  delete entry;
+}
+
+const BitcaskEntry *Bitcask::lookup(const char *key, std::optional<BitcaskEntry> &sealed) {
+  // keydir entries are not copied, their inline value is only read in place
+  BitcaskEntry *entry = key_dir->get(key);
+  if (entry != nullptr) {
+    return entry->IsTombstone() ? nullptr : entry;
+  }
+  sealed = find_sealed(key);
+  return sealed ? &*sealed : nullptr;
+}
+
+bool Bitcask::has_entry(const char *key) {
+  std::optional<BitcaskEntry> sealed;
+  return lookup(key, sealed) != nullptr;
+}
+
+std::optional<BitcaskEntry> Bitcask::find_sealed(const char *key) {
+  // newest file first, its bloom filter skips most of the absent keys
+  for (const auto &[file_id, index] : sealed_indexes) {
+    metrics.bloom_checks.Add();
+    if (!index->MayContain(key)) {
+      metrics.bloom_negatives.Add();
+      continue;
+    }
+    std::optional<IndexEntry> found = index->Search(key);
+    if (!found) {
+      metrics.bloom_false_positives.Add();
+      continue;
+    }
+    if (found->IsTombstone())
+      return std::nullopt;
+    return BitcaskEntry(file_id, found->record_size, found->record_offset);
+  }
+  return std::nullopt;
+}
+
+void Bitcask::scan_entries(
+    const char *from,
+    const std::function<bool(const std::string &key, const BitcaskEntry &entry)>
+        &callback) {
+  // k-way merge of the keydir and the sealed indexes, sources are ranked by
+  // recency so that the newest version of a key comes out first
+  std::vector<std::pair<uint64_t, SortedIndex *>> indexes;
+  std::vector<size_t> positions;
+  for (const auto &[file_id, index] : sealed_indexes) {
+    indexes.push_back({file_id, index.get()});
+    positions.push_back(index->LowerBound(from));
+  }
+  auto it = key_dir->begin(from);
+
+  typedef std::pair<std::string, size_t> head_t;
+  std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> heads;
+  auto advance = [&](size_t rank) {
+    if (rank == 0) {
+      if (it != key_dir->end())
+        heads.push({it.key(), 0});
+      return;
+    }
+    auto &[_, index] = indexes[rank - 1];
+    if (positions[rank - 1] < index->GetNumEntries())
+      heads.push({index->GetEntry(positions[rank - 1]).key, rank});
+  };
+  for (size_t rank = 0; rank <= indexes.size(); ++rank) {
+    advance(rank);
+  }
+
+  while (!heads.empty()) {
+    auto [key, rank] = heads.top();
+    // keydir entries are passed in place, those of an index are built
+    const BitcaskEntry *entry = nullptr;
+    std::optional<BitcaskEntry> sealed;
+    while (!heads.empty() && heads.top().first == key) {
+      size_t source = heads.top().second;
+      heads.pop();
+      if (source == 0) {
+        if (source == rank && !(*it)->IsTombstone())
+          entry = *it;
+        ++it;
+      } else {
+        auto &[file_id, index] = indexes[source - 1];
+        IndexEntry found = index->GetEntry(positions[source - 1]++);
+        if (source == rank && !found.IsTombstone()) {
+          sealed.emplace(file_id, found.record_size, found.record_offset);
+          entry = &*sealed;
+        }
+      }
+      advance(source);
+    }
+    if (entry != nullptr && !callback(key, *entry)) {
+      return;
+    }
+  }
+}
+
+void Bitcask::set_entry(const char *key, BitcaskEntry *entry) {
+  BitcaskEntry *previous = key_dir->set(key, entry);
+  if (previous == nullptr) {
+    std::optional<BitcaskEntry> sealed = find_sealed(key);
+    if (sealed) {
+      discard(*sealed);
+    } else {
+      size += 1;
+    }
+    return;
+  }
+
+  if (previous->IsTombstone()) {
+    size += 1;
+  } else {
+    discard(*previous);
+  }
+  free_entry(previous);
+}
+
+void Bitcask::remove_entry(const char *key, uint64_t file_id) {
+  if (!options.low_memory_keydir) {
+    BitcaskEntry *previous = key_dir->del(key);
+    discard(*previous);
+    free_entry(previous);
+    size -= 1;
+    return;
+  }
+
+  // older versions may live in sealed files, hide them behind a tombstone
+  BitcaskEntry *previous = key_dir->set(key, new BitcaskEntry(file_id, 0, 0));
+  if (previous == nullptr) {
+    discard(*find_sealed(key));
+  } else {
+    discard(*previous);
+    free_entry(previous);
+  }
+  size -= 1;
+}
+
+void Bitcask::discard(const BitcaskEntry &entry) {
+  // the overwritten record is now garbage in its file
+  auto file = open_files.find(entry.file_id);
+  if (file != open_files.end()) {
+    file->second.disposable_size += entry.record_size;
+  }
+}
+
+size_t Bitcask::copy_record(const BitcaskEntry &entry, AppendWriter &writer) {
+  ReadRequest request = read_request(&entry);
+  request.Execute();
+  if (request.error) {
+    std::rethrow_exception(request.error);
+  }
+
+  // the record ends with its own offset, used to walk the log backward
+  std::string &buffer = request.buffer;
+  size_t record_offset = writer.GetSize();
+  buffer.replace(buffer.length() - sizeof(size_t), sizeof(size_t),
+                 ByteOrder::toBigEndianString<size_t>(record_offset));
+  writer.Append(buffer.data(), buffer.length());
+  metrics.compaction_bytes_done.fetch_add(buffer.length(), std::memory_order_relaxed);
+  return record_offset;
+}
+
+size_t Bitcask::copy_record(const RecordView &record, AppendWriter &writer) {
+  // the record ends with its own offset, used to walk the log backward
+  size_t record_offset = writer.GetSize();
+  writer.Append(record.data, record.size - sizeof(size_t));
+  std::string offset = ByteOrder::toBigEndianString<size_t>(record_offset);
+  writer.Append(offset.data(), offset.length());
+  metrics.compaction_bytes_done.fetch_add(record.size, std::memory_order_relaxed);
+  return record_offset;
 }
 
 std::tuple<size_t, size_t> Bitcask::write_value(const char *key, const char *value) {
+  size_t key_size = std::strlen(key);
+  size_t value_size = std::strlen(value);
+  size_t length = BitcaskLayout::GetRecordSize(key_size, value_size);
+  if (options.max_file_size > 0 && bitcask_file(active_file_id).total_size > 0 &&
+      bitcask_file(active_file_id).total_size + length > options.max_file_size) {
+    rollover();
+  }
+
   // position the writer
-  std::fstream &writer = bitcask_file(active_file_id).GetFileStream();
-  writer.seekp(0, std::ios_base::end);
-  size_t record_offset = writer.tellp();
+  BitcaskFile &file = bitcask_file(active_file_id);
+  AppendWriter &writer = file.GetWriter();
+  size_t record_offset = writer.GetSize();
+
+  std::string buffer;
+  encode_record(buffer, key, value, record_offset);
+  writer.Append(buffer.data(), buffer.length());
+  file.total_size = writer.GetSize();
+  if (options.sync_writes) {
+    writer.Sync();
+  }
+  notify_tails();
 
-  // calculate checksum
-  std::string buffer(key);
-  buffer.append(value);
-  uint32_t checksum = crc32_checksum(buffer.data(), buffer.length());
+  return std::make_tuple(buffer.length(), record_offset);
+}
 
+void Bitcask::encode_record(std::string &buffer, const char *key,
+                            const char *value, size_t record_offset) {
   size_t key_size = std::strlen(key);
   size_t value_size = std::strlen(value);
 
-  buffer.clear();
-  buffer.append(ByteOrder::toLittleEndianString<uint32_t>(checksum));
-  buffer.append(ByteOrder::toLittleEndianString<size_t>(key_size));
-  buffer.append(ByteOrder::toLittleEndianString<size_t>(value_size));
+  // calculate checksum
+  std::string data(key, key_size);
+  data.append(value, value_size);
+  uint32_t checksum = crc32_checksum(data.data(), data.length());
+
+  buffer.append(ByteOrder::toBigEndianString<uint32_t>(checksum));
+  buffer.append(ByteOrder::toBigEndianString<size_t>(key_size));
+  buffer.append(ByteOrder::toBigEndianString<size_t>(value_size));
+  buffer.append(data);
+  buffer.append(ByteOrder::toBigEndianString<size_t>(record_offset));
+}
+
+void Bitcask::encode_hint(std::string &buffer, const std::string &key,
+                          size_t record_size, size_t record_offset) {
+  buffer.append(ByteOrder::toBigEndianString<size_t>(key.length()));
   buffer.append(key);
-  buffer.append(value);
-  buffer.append(ByteOrder::toLittleEndianString<size_t>(record_offset));
+  buffer.append(ByteOrder::toBigEndianString<size_t>(record_size));
+  buffer.append(ByteOrder::toBigEndianString<size_t>(record_offset));
+}
 
-  writer.write(buffer.data(), buffer.length());
+void Bitcask::flush_memtable() {
+  if (memtable.empty())
+    return;
 
-  return std::make_tuple(buffer.length(), record_offset);
+  // survivors are encoded back to back and appended with a single write,
+  // the keydir is only updated once their file holds them
+  std::string batch;
+  std::vector<std::tuple<const std::string *, const std::string *, size_t, size_t>> pending;
+  auto commit = [&]() {
+    BitcaskFile &file = bitcask_file(active_file_id);
+    file.GetWriter().Append(batch.data(), batch.length());
+    file.total_size = file.GetWriter().GetSize();
+    for (const auto &[key, value, record_size, record_offset] : pending) {
+      if (value == nullptr) {
+        file.disposable_size += record_size;
+        remove_entry(key->c_str(), active_file_id);
+      } else {
+        set_entry(key->c_str(), new_entry(active_file_id, record_size, record_offset,
+                                          value->data(), value->length()));
+      }
+    }
+    batch.clear();
+    pending.clear();
+  };
+
+  for (const auto &[key, value] : memtable) {
+    // a key created and deleted within the same flush never reaches the log
+    if (!value && !has_entry(key.c_str()))
+      continue;
+
+    const char *data = value ? value->c_str() : Bitcask::TOMBSTONE;
+    size_t length = BitcaskLayout::GetRecordSize(key.length(), std::strlen(data));
+    size_t record_offset = bitcask_file(active_file_id).total_size + batch.length();
+    if (options.max_file_size > 0 && record_offset > 0 &&
+        record_offset + length > options.max_file_size) {
+      commit();
+      rollover();
+      record_offset = 0;
+    }
+    encode_record(batch, key.c_str(), data, record_offset);
+    pending.push_back({&key, value ? &*value : nullptr, length, record_offset});
+  }
+  commit();
+
+  memtable.clear();
+  memtable_bytes = 0;
+  memtable_size_delta = 0;
+  if (options.sync_writes) {
+    bitcask_file(active_file_id).GetWriter().Sync();
+  }
+  notify_tails();
+}
+
+const std::optional<std::string> *Bitcask::find_pending(const char *key) {
+  auto pending = memtable.find(key);
+  return pending == memtable.end() ? nullptr : &pending->second;
+}
+
+bool Bitcask::is_live(const char *key) {
+  const std::optional<std::string> *pending = find_pending(key);
+  if (pending != nullptr)
+    return pending->has_value();
+  return has_entry(key);
+}
+
+void Bitcask::absorb(const char *key, std::optional<std::string> value) {
+  bool was_live = is_live(key);
+  auto [slot, is_new] = memtable.try_emplace(key);
+  if (!is_new) {
+    memtable_bytes -= slot->first.length() + (slot->second ? slot->second->length() : 0);
+  }
+  memtable_size_delta += (value ? 1 : 0) - (was_live ? 1 : 0);
+  memtable_bytes += slot->first.length() + (value ? value->length() : 0);
+  slot->second = std::move(value);
+
+  if (memtable_bytes >= options.memtable_size) {
+    flush_memtable();
+  }
+}
+
+void Bitcask::run_flusher() {
+  std::unique_lock flusher_lock(flusher_mutex);
+  while (!flusher_stopping) {
+    flusher_condition.wait_for(
+        flusher_lock, std::chrono::milliseconds(options.memtable_flush_interval_ms));
+    if (flusher_stopping)
+      break;
+
+    // writes stay pending on failure, the next flush retries them
+    flusher_lock.unlock();
+    std::string error;
+    {
+      std::unique_lock lock = lock_exclusive();
+      try {
+        flush_memtable();
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+    }
+    flusher_lock.lock();
+    flush_error = error;
+  }
+}
+
+void Bitcask::notify_tails() {
+  // writers only pay for the wake up while someone is tailing
+  if (num_tails.load() == 0)
+    return;
+  {
+    std::lock_guard tail_lock(tail_mutex);
+    tail_sequence += 1;
+  }
+  tail_condition.notify_all();
+}
+
+std::optional<LogChange> Bitcask::read_change(LogPosition &position, bool &compacted) {
+  std::shared_lock lock = lock_shared();
+  ensure();
+
+  // move past the end of sealed files, the active one ends the log
+  std::unordered_map<uint64_t, BitcaskFile>::iterator file;
+  while (true) {
+    if (position.file_id == 0) {
+      uint64_t oldest = active_file_id;
+      for (const auto &[file_id, _] : open_files) {
+        oldest = std::min(oldest, file_id);
+      }
+      position = LogPosition{oldest, 0};
+    }
+
+    file = open_files.find(position.file_id);
+    if (file == open_files.end()) {
+      // the compaction output holds nothing new for a tail that was up to date
+      if (compacted_end.file_id != 0 && position == compacted_end) {
+        position = LogPosition{compacted_next, 0};
+        compacted = true;
+        continue;
+      }
+      throw Exception("The tail position is no longer in the bitcask storage log.");
+    }
+    if (position.offset > file->second.total_size) {
+      throw Exception("The tail position is past the end of its bitcask file.");
+    }
+    if (position.offset < file->second.total_size)
+      break;
+    if (position.file_id == active_file_id)
+      return std::nullopt;
+
+    uint64_t next_file_id = active_file_id;
+    for (const auto &[file_id, _] : open_files) {
+      if (file_id > position.file_id && file_id < next_file_id) {
+        next_file_id = file_id;
+      }
+    }
+    position = LogPosition{next_file_id, 0};
+  }
+
+  BitcaskFile &btcsk_file = file->second;
+  BitcaskLayout layout(0);
+  size_t available = btcsk_file.total_size - position.offset;
+  // the header comes with a guess of the body, most records take a single read
+  std::string record;
+  if (btcsk_file.IsBuffered(position.offset)) {
+    const char *data = btcsk_file.GetWriter().GetBuffered(position.offset);
+    record.assign(data, std::min<size_t>(layout.GetKeyOffset(), available));
+  } else {
+    record = read_data(*file_reader(position.file_id), position.offset,
+                       std::min(TAIL_READ_SIZE, available));
+  }
+  if (record.length() < layout.GetKeyOffset()) {
+    throw Exception("Truncated record in the bitcask storage log.");
+  }
+
+  uint32_t checksum = ByteOrder::fromBigEndian<uint32_t>(record.data());
+  size_t key_size = ByteOrder::fromBigEndian<size_t>(record.data() + layout.GetKeySizeOffset());
+  size_t value_size =
+      ByteOrder::fromBigEndian<size_t>(record.data() + layout.GetValueSizeOffset());
+  size_t record_size = BitcaskLayout::GetRecordSize(key_size, value_size);
+  if (key_size > available || value_size > available || record_size > available) {
+    throw Exception("Truncated record in the bitcask storage log.");
+  }
+  if (btcsk_file.IsBuffered(position.offset)) {
+    record.assign(btcsk_file.GetWriter().GetBuffered(position.offset), record_size);
+  } else if (record.length() < record_size) {
+    record += read_data(*file_reader(position.file_id), position.offset + record.length(),
+                        record_size - record.length());
+  } else {
+    record.resize(record_size);
+  }
+  if (crc32_checksum(record.data() + layout.GetKeyOffset(), key_size + value_size) != checksum) {
+    throw Exception("Corrupted record in the bitcask storage log.");
+  }
+
+  auto [key, value] = decode_record(record);
+  LogChange change{position, std::move(key), std::nullopt};
+  if (value != Bitcask::TOMBSTONE) {
+    change.value = std::move(value);
+  }
+  position.offset += record_size;
+  return change;
+}
+
+std::vector<SealedFile> Bitcask::sealed_files(LogPosition &end) {
+  std::shared_lock lock = lock_shared();
+  ensure();
+
+  // the handles keep the files readable if a compaction removes them
+  std::vector<SealedFile> files;
+  for (const auto &[file_id, file] : open_files) {
+    if (file_id != active_file_id) {
+      files.push_back(SealedFile{file_id, file.total_size, file_reader(file_id)});
+    }
+  }
+  std::sort(files.begin(), files.end(), [](const SealedFile &a, const SealedFile &b) {
+    return a.file_id < b.file_id;
+  });
+  end = LogPosition{active_file_id, 0};
+  return files;
+}
+
+LogPosition Bitcask::replay(const LogChange &change) {
+  std::unique_lock lock = lock_exclusive();
+  ensure();
+
+  // records land at the same file id and offset as on the leader
+  const LogPosition &position = change.position;
+  if (position.file_id > active_file_id) {
+    rollover_to(position.file_id);
+  }
+  if (position.file_id != active_file_id ||
+      position.offset != bitcask_file(active_file_id).total_size) {
+    throw Exception("The replicated record does not follow the log of the replica.");
+  }
+
+  const char *key = change.key.c_str();
+  if (change.value) {
+    auto [record_size, record_offset] = write_value(key, change.value->c_str());
+    set_entry(key, new_entry(active_file_id, record_size, record_offset, change.value->data(),
+                             change.value->length()));
+    return LogPosition{active_file_id, record_offset + record_size};
+  }
+
+  bool was_live = is_live(key);
+  auto [record_size, record_offset] = write_value(key, Bitcask::TOMBSTONE);
+  bitcask_file(active_file_id).disposable_size += record_size;
+  if (was_live) {
+    remove_entry(key, active_file_id);
+  }
+  return LogPosition{active_file_id, record_offset + record_size};
+}
+
+std::string Bitcask::read_data(const FileHandle &reader, size_t offset,
+                               size_t size) {
+  return reader.ReadAt(offset, size);
+}
+
+std::shared_ptr<FileHandle> Bitcask::file_reader(uint64_t file_id) {
+  // the active and compaction files are pinned, sealed ones go through the cache
+  const std::shared_ptr<FileHandle> &reader = bitcask_file(file_id).GetReader();
+  if (reader != nullptr)
+    return reader;
+  return file_cache.Get(file_id, data_file(file_id));
+}
+
+ReadRequest Bitcask::read_request(const BitcaskEntry *entry, size_t index) {
+  BitcaskFile &file = bitcask_file(entry->file_id);
+  ReadRequest request(file_reader(entry->file_id), entry->file_id, entry->record_offset,
+                      entry->record_size, index);
+  if (file.IsBuffered(entry->record_offset)) {
+    // copy it while the lock still protects the write buffer
+    request.buffer.assign(file.GetWriter().GetBuffered(entry->record_offset),
+                          entry->record_size);
+    request.completed = true;
+    metrics.buffer_hits.Add();
+  } else {
+    metrics.disk_reads.Add();
+  }
+  return request;
+}
+
+void Bitcask::submit(std::shared_lock<std::shared_mutex> &lock,
+                     std::vector<ReadRequest> batch, batch_callback_t callback) {
+  // the requests hold their file handles, no read needs the lock. Batches
+  // queued on the engine are drained by Close before it goes away
+  if (io_engine != nullptr) {
+    io_engine->Submit(std::move(batch), std::move(callback));
+    lock.unlock();
+    return;
+  }
+
+  // no engine, serve the batch on the calling thread outside of the lock
+  lock.unlock();
+  std::sort(batch.begin(), batch.end(),
+            [](const ReadRequest &a, const ReadRequest &b) {
+              return std::tie(a.file_id, a.offset) <
+                     std::tie(b.file_id, b.offset);
+            });
+  for (auto &request : batch) {
+    request.Execute();
+  }
+  callback(batch);
+}
+
+std::string Bitcask::decode_value(const char *record) {
+  BitcaskLayout layout(0);
+  size_t key_size =
+      ByteOrder::fromBigEndian<size_t>(record + layout.GetKeySizeOffset());
+  size_t value_size =
+      ByteOrder::fromBigEndian<size_t>(record + layout.GetValueSizeOffset());
+  return std::string(record + layout.GetValueOffset(key_size), value_size);
 }
 
-std::string Bitcask::read_data(std::istream &reader, size_t offset, size_t size) {
-  reader.seekg(offset, std::ios_base::beg);
-  std::string buffer(size, '\0');
-  reader.read(buffer.data(), size);
-  return buffer;
+std::tuple<std::string, std::string>
+Bitcask::decode_record(const std::string &record) {
+  BitcaskLayout layout(0);
+  size_t key_size = ByteOrder::fromBigEndian<size_t>(
+      record.data() + layout.GetKeySizeOffset());
+  size_t value_size = ByteOrder::fromBigEndian<size_t>(
+      record.data() + layout.GetValueSizeOffset());
+  return std::make_tuple(record.substr(layout.GetKeyOffset(), key_size),
+                         record.substr(layout.GetValueOffset(key_size), value_size));
 }
 
 } // namespace bitcaskcpp
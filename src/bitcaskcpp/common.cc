@@ -1,8 +1,12 @@
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <ctime>
 #include <filesystem>
 #include <fstream>
 
 #include "bitcaskcpp/common.h"
+#include "bitcaskcpp/exception.h"
 #include "crc32c/crc32c.h"
 
 namespace bitcaskcpp {
@@ -13,4 +17,15 @@ uint32_t crc32_checksum(const char *data, size_t length) {
   return crc32c::Crc32c(data, length);
 }
 
+void sync_path(const std::filesystem::path &path, bool directory) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | (directory ? O_DIRECTORY : 0));
+  if (fd < 0 || ::fsync(fd) != 0) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    throw Exception("Unable to sync " + path.string());
+  }
+  ::close(fd);
+}
+
 } // namespace bitcaskcpp
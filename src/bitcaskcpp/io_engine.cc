@@ -0,0 +1,209 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <tuple>
+
+#include "bitcaskcpp/io_engine.h"
+
+namespace bitcaskcpp {
+
+// engine whose worker is the calling thread
+static thread_local const IOEngine *current_engine = nullptr;
+
+FileHandle::FileHandle(const fs::path &file_path, IOCounters *counters)
+    : counters{counters} {
+  fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw Exception("Unable to open bitcask data file: " +
+                    std::string(std::strerror(errno)));
+  }
+}
+
+FileHandle::~FileHandle() { ::close(fd); }
+
+void FileHandle::ReadAt(size_t offset, char *buffer, size_t size) const {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = ::pread(fd, buffer + done, size - done, offset + done);
+    if (counters != nullptr) {
+      counters->read_calls.Add();
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      throw Exception("Unable to read from bitcask data file.");
+    }
+    done += n;
+  }
+  if (counters != nullptr) {
+    counters->bytes_read.Add(size);
+  }
+}
+
+std::string FileHandle::ReadAt(size_t offset, size_t size) const {
+  std::string buffer(size, '\0');
+  ReadAt(offset, buffer.data(), size);
+  return buffer;
+}
+
+void FileHandle::DropCache() const {
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+FileCache::FileCache(size_t capacity, IOCounters *io_counters,
+                     FileCacheCounters *counters)
+    : capacity{std::max<size_t>(capacity, 1)}, io_counters{io_counters},
+      counters{counters} {}
+
+std::shared_ptr<FileHandle> FileCache::Get(uint64_t file_id,
+                                           const fs::path &file_path) {
+  std::lock_guard lock(mutex);
+  auto found = positions.find(file_id);
+  if (found != positions.end()) {
+    handles.splice(handles.begin(), handles, found->second);
+    if (counters != nullptr) {
+      counters->hits.Add();
+    }
+    return found->second->second;
+  }
+
+  auto handle = std::make_shared<FileHandle>(file_path, io_counters);
+  handles.emplace_front(file_id, handle);
+  positions[file_id] = handles.begin();
+  while (handles.size() > capacity) {
+    positions.erase(handles.back().first);
+    handles.pop_back();
+    if (counters != nullptr) {
+      counters->evictions.Add();
+    }
+  }
+  if (counters != nullptr) {
+    counters->reopens.Add();
+    counters->open_files = handles.size();
+  }
+  return handle;
+}
+
+void FileCache::Erase(uint64_t file_id) {
+  std::lock_guard lock(mutex);
+  auto found = positions.find(file_id);
+  if (found == positions.end())
+    return;
+  handles.erase(found->second);
+  positions.erase(found);
+  if (counters != nullptr) {
+    counters->open_files = handles.size();
+  }
+}
+
+void FileCache::Clear() {
+  std::lock_guard lock(mutex);
+  handles.clear();
+  positions.clear();
+  if (counters != nullptr) {
+    counters->open_files = 0;
+  }
+}
+
+void ReadRequest::Execute() {
+  if (completed)
+    return;
+  try {
+    buffer = file->ReadAt(offset, size);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  completed = true;
+}
+
+IOEngine::IOEngine(size_t num_threads) : stopping{false} {
+  num_threads = std::max<size_t>(num_threads, 1);
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers.emplace_back([this] { run(); });
+  }
+}
+
+IOEngine::~IOEngine() {
+  {
+    std::unique_lock lock(mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void IOEngine::Submit(std::vector<ReadRequest> batch,
+                      batch_callback_t callback) {
+  std::sort(batch.begin(), batch.end(),
+            [](const ReadRequest &a, const ReadRequest &b) {
+              return std::tie(a.file_id, a.offset) <
+                     std::tie(b.file_id, b.offset);
+            });
+
+  if (batch.empty()) {
+    callback(batch);
+    return;
+  }
+
+  // split the sorted batch into contiguous chunks, one per worker, so reads
+  // on the same file stay ordered while the workers keep the device busy
+  struct BatchState {
+    std::vector<ReadRequest> batch;
+    batch_callback_t callback;
+    std::atomic<size_t> pending;
+  };
+  size_t num_chunks = std::min(workers.size(), batch.size());
+  size_t chunk_size = (batch.size() + num_chunks - 1) / num_chunks;
+  num_chunks = (batch.size() + chunk_size - 1) / chunk_size;
+
+  auto state = std::make_shared<BatchState>();
+  state->batch = std::move(batch);
+  state->callback = std::move(callback);
+  state->pending = num_chunks;
+
+  for (size_t begin = 0; begin < state->batch.size(); begin += chunk_size) {
+    size_t end = std::min(begin + chunk_size, state->batch.size());
+    enqueue([state, begin, end] {
+      for (size_t i = begin; i < end; ++i) {
+        state->batch[i].Execute();
+      }
+      if (state->pending.fetch_sub(1) == 1) {
+        state->callback(state->batch);
+      }
+    });
+  }
+}
+
+bool IOEngine::IsWorker() const { return current_engine == this; }
+
+void IOEngine::run() {
+  current_engine = this;
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock lock(mutex);
+      condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty())
+        return;
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void IOEngine::enqueue(std::function<void()> task) {
+  {
+    std::unique_lock lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  condition.notify_one();
+}
+
+} // namespace bitcaskcpp
@@ -0,0 +1,49 @@
+#include "bitcaskcpp/log_tail.h"
+
+namespace bitcaskcpp {
+
+LogTail::LogTail(Bitcask &storage, LogPosition from)
+    : storage{storage}, position{from}, stopped{false}, num_compactions{0} {
+  storage.num_tails += 1;
+}
+
+LogTail::~LogTail() { storage.num_tails -= 1; }
+
+std::optional<LogChange> LogTail::Next(std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (true) {
+    // a record appended after this point bumps the sequence
+    uint64_t sequence;
+    {
+      std::lock_guard tail_lock(storage.tail_mutex);
+      if (stopped)
+        return std::nullopt;
+      sequence = storage.tail_sequence;
+    }
+
+    bool compacted = false;
+    std::optional<LogChange> change = storage.read_change(position, compacted);
+    if (compacted) {
+      num_compactions += 1;
+    }
+    if (change)
+      return change;
+
+    std::unique_lock tail_lock(storage.tail_mutex);
+    bool woken = storage.tail_condition.wait_until(tail_lock, deadline, [&]() {
+      return stopped || storage.tail_sequence != sequence;
+    });
+    if (!woken)
+      return std::nullopt;
+  }
+}
+
+void LogTail::Stop() {
+  {
+    std::lock_guard tail_lock(storage.tail_mutex);
+    stopped = true;
+  }
+  storage.tail_condition.notify_all();
+}
+
+}  // namespace bitcaskcpp
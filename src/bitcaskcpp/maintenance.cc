@@ -0,0 +1,483 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+#include "bitcaskcpp/append_writer.h"
+#include "bitcaskcpp/maintenance.h"
+
+namespace bitcaskcpp {
+
+// runs task(i) for every i below num_tasks, the first failure is rethrown
+static void parallel_for(size_t num_tasks, size_t num_threads,
+                         const std::function<void(size_t)> &task) {
+  std::atomic<size_t> next{0};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto work = [&]() {
+    size_t i;
+    while ((i = next.fetch_add(1)) < num_tasks) {
+      try {
+        task(i);
+      } catch (...) {
+        std::lock_guard lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        next = num_tasks;
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(std::max<size_t>(num_threads, 1), num_tasks); ++i) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+OfflineStorage::OfflineStorage(const fs::path &storage_dir, const fs::path &cold_storage_dir,
+                               bool read_only)
+    : storage_dir{storage_dir},
+      cold_storage_dir{cold_storage_dir},
+      read_only{read_only},
+      manifest{storage_dir},
+      max_file_id{0} {
+  if (!fs::is_directory(storage_dir)) {
+    throw Exception("bitcask storage not found: " + storage_dir.string());
+  }
+
+  // the same lock as Bitcask::Open, created exclusively
+  int fd = ::open((storage_dir / Bitcask::LOCK_FILE).c_str(),
+                  O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw Exception(errno == EEXIST
+                        ? "bitcask storage already in use by another process"
+                        : "Unable to lock bitcask storage: " + std::string(std::strerror(errno)));
+  }
+  std::string stamp = std::to_string(timestamp());
+  ssize_t ignored = ::write(fd, stamp.data(), stamp.length());
+  (void)ignored;
+  ::close(fd);
+
+  // obsolete files are removed as Bitcask::Open would, the lock is held
+  ManifestState state = manifest.Load();
+  for (const auto &[file_id, file] : state.files) {
+    if (file.cold && cold_storage_dir.empty()) {
+      fs::remove(storage_dir / Bitcask::LOCK_FILE);
+      throw Exception("bitcask storage has cold files but no cold storage directory.");
+    }
+  }
+  if (!read_only) {
+    for (uint64_t file_id : state.obsolete) {
+      fs::remove(data_file(file_id));
+      fs::remove(hint_file(file_id));
+      fs::remove(index_file(file_id));
+      fs::remove(Bitcask::temp_file(hint_file(file_id)));
+      fs::remove(Bitcask::temp_file(index_file(file_id)));
+      if (!cold_storage_dir.empty()) {
+        fs::remove(cold_storage_dir / data_file(file_id).filename());
+      }
+    }
+    state.obsolete.clear();
+    for (const auto &[file_id, file] : state.files) {
+      if (!file.has_hint) {
+        fs::remove(Bitcask::temp_file(hint_file(file_id)));
+      }
+      if (!file.has_index) {
+        fs::remove(Bitcask::temp_file(index_file(file_id)));
+      }
+    }
+    manifest.Rewrite(state);
+  }
+  for (const auto &[file_id, _] : state.files) {
+    file_ids.push_back(file_id);
+  }
+  files = std::move(state.files);
+  max_file_id = state.max_file_id;
+}
+
+OfflineStorage::~OfflineStorage() {
+  std::error_code ignored;
+  fs::remove(storage_dir / Bitcask::LOCK_FILE, ignored);
+}
+
+std::vector<FileVerification> OfflineStorage::Verify(size_t num_threads) {
+  std::vector<FileVerification> results(file_ids.size());
+  parallel_for(file_ids.size(), num_threads, [&](size_t i) {
+    FileVerification &result = results[i];
+    result = FileVerification{file_ids[i], fs::file_size(data_file(file_ids[i])), 0, 0,
+                              std::nullopt, ""};
+    RecordReader reader(data_file(file_ids[i]), file_ids[i]);
+    Record record;
+    while (reader.Next(record)) {
+      result.num_records += 1;
+      if (!record.valid) {
+        result.num_corrupted += 1;
+        if (!result.first_corrupted) {
+          result.first_corrupted = record.offset;
+        }
+      }
+    }
+    result.error = reader.GetError();
+  });
+  return results;
+}
+
+void OfflineStorage::ForEachRecord(const std::function<bool(const Record &)> &callback) {
+  for (uint64_t file_id : file_ids) {
+    RecordReader reader(data_file(file_id), file_id);
+    Record record;
+    while (reader.Next(record)) {
+      if (!callback(record))
+        return;
+    }
+    if (!reader.GetError().empty()) {
+      throw Exception("Corrupted data file " + std::to_string(file_id) + ": " +
+                      reader.GetError());
+    }
+  }
+}
+
+void OfflineStorage::ForEachLive(size_t num_threads,
+                                 const std::function<bool(const Record &)> &callback) {
+  std::map<std::string, BitcaskEntry> key_dir = build_key_dir(num_threads);
+  std::unordered_map<uint64_t, std::unique_ptr<FileHandle>> readers;
+  for (const auto &[key, entry] : key_dir) {
+    auto &reader = readers[entry.file_id];
+    if (reader == nullptr) {
+      reader = std::make_unique<FileHandle>(data_file(entry.file_id));
+    }
+    if (!callback(read_record(*reader, entry.file_id, entry)))
+      return;
+  }
+}
+
+std::vector<HintRebuild> OfflineStorage::RebuildHints(size_t num_threads) {
+  ensure_writable();
+  std::vector<uint64_t> missing;
+  for (uint64_t file_id : file_ids) {
+    if (!files.at(file_id).has_hint) {
+      missing.push_back(file_id);
+    }
+  }
+
+  // a damaged file is reported and left without hint, it is replayed on open
+  std::vector<HintRebuild> results(missing.size());
+  parallel_for(missing.size(), num_threads, [&](size_t i) {
+    results[i] = HintRebuild{missing[i], 0, ""};
+    try {
+      std::map<std::string, BitcaskEntry> entries = latest_entries(missing[i]);
+      write_hint(missing[i], entries);
+      results[i].num_entries = entries.size();
+    } catch (const Exception &e) {
+      results[i].error = e.what();
+    }
+  });
+
+  // a hinted file is sealed, Bitcask::Open no longer appends to it
+  for (const HintRebuild &result : results) {
+    if (!result.error.empty())
+      continue;
+    ManifestFile &file = files.at(result.file_id);
+    file.sealed = true;
+    file.size = fs::file_size(data_file(result.file_id));
+    file.has_hint = true;
+    manifest.Seal(result.file_id, file.size, true, file.has_index);
+  }
+  return results;
+}
+
+std::vector<FileUsage> OfflineStorage::Fragmentation(size_t num_threads) {
+  std::map<uint64_t, FileUsage> usages;
+  for (uint64_t file_id : file_ids) {
+    usages.emplace(file_id, FileUsage{file_id, fs::file_size(data_file(file_id)), 0, 0,
+                                      files.at(file_id).has_hint});
+  }
+  for (const auto &[_, entry] : build_key_dir(num_threads)) {
+    FileUsage &usage = usages.at(entry.file_id);
+    usage.live_size += entry.record_size;
+    usage.num_live += 1;
+  }
+
+  std::vector<FileUsage> results;
+  for (const auto &[_, usage] : usages) {
+    results.push_back(usage);
+  }
+  return results;
+}
+
+MergeSummary OfflineStorage::Merge(size_t num_threads, size_t max_file_size) {
+  ensure_writable();
+  std::map<std::string, BitcaskEntry> key_dir = build_key_dir(num_threads);
+  MergeSummary summary{file_ids.size(), 0, key_dir.size(), {}, 0};
+  for (uint64_t file_id : file_ids) {
+    summary.input_size += fs::file_size(data_file(file_id));
+  }
+
+  // records stay on the tier of their file like Bitcask::Compact keeps the
+  // records of cold files on the cold tier. Each tier is copied in file order
+  // so that every stream reads sequentially, the streams of a tier get about
+  // the same number of bytes
+  auto is_cold = [&](const BitcaskEntry *entry) { return files.at(entry->file_id).cold; };
+  std::vector<std::pair<const std::string *, const BitcaskEntry *>> records;
+  for (const auto &[key, entry] : key_dir) {
+    records.push_back({&key, &entry});
+  }
+  std::sort(records.begin(), records.end(), [&](const auto &a, const auto &b) {
+    return std::make_tuple(!is_cold(a.second), a.second->file_id, a.second->record_offset) <
+           std::make_tuple(!is_cold(b.second), b.second->file_id, b.second->record_offset);
+  });
+
+  struct Stream {
+    size_t begin;
+    size_t end;
+    bool cold;
+  };
+  std::vector<Stream> streams;
+  for (size_t begin = 0, end; begin < records.size(); begin = end) {
+    bool cold = is_cold(records[begin].second);
+    size_t live_size = 0;
+    for (end = begin; end < records.size() && is_cold(records[end].second) == cold; ++end) {
+      live_size += records[end].second->record_size;
+    }
+    size_t num_streams = std::max<size_t>(std::min(num_threads, end - begin), 1);
+    size_t first = streams.size();
+    streams.push_back({begin, end, cold});
+    size_t accumulated = 0;
+    for (size_t i = begin; i < end; ++i) {
+      accumulated += records[i].second->record_size;
+      size_t num_bounds = streams.size() - first;
+      if (num_bounds < num_streams && i + 1 < end &&
+          accumulated * num_streams >= live_size * num_bounds) {
+        streams.back().end = i + 1;
+        streams.push_back({i + 1, end, cold});
+      }
+    }
+  }
+
+  std::unordered_map<uint64_t, std::unique_ptr<FileHandle>> readers;
+  for (uint64_t file_id : file_ids) {
+    readers.emplace(file_id, std::make_unique<FileHandle>(data_file(file_id)));
+  }
+
+  // outputs are numbered after every existing file, so their records win until
+  // the inputs are gone. They are listed as merge outputs before being
+  // written, a crash leaves them obsolete for the next open to remove
+  uint64_t next_id = max_file_id + 1;
+  std::mutex output_mutex;
+  std::set<uint64_t> cold_outputs;
+  auto add_output = [&](bool cold) {
+    std::lock_guard lock(output_mutex);
+    manifest.AddMergeOutput(next_id);
+    summary.output_files.push_back(next_id);
+    if (cold) {
+      cold_outputs.insert(next_id);
+    }
+    return next_id++;
+  };
+  parallel_for(streams.size(), num_threads, [&](size_t stream) {
+    uint64_t output_id = 0;
+    std::unique_ptr<AppendWriter> writer;
+    std::ofstream hint_writer;
+    auto seal = [&]() {
+      if (writer == nullptr)
+        return;
+      writer->Sync();
+      writer.reset();
+      hint_writer.close();
+      if (hint_writer.fail()) {
+        throw Exception("Unable to write merged hint file.");
+      }
+      sync_path(hint_file(output_id));
+    };
+
+    for (size_t i = streams[stream].begin; i < streams[stream].end; ++i) {
+      const auto &[key, entry] = records[i];
+      if (writer == nullptr || (max_file_size > 0 && writer->GetSize() > 0 &&
+                                writer->GetSize() + entry->record_size > max_file_size)) {
+        seal();
+        output_id = add_output(streams[stream].cold);
+        writer = std::make_unique<AppendWriter>(data_file(output_id, streams[stream].cold),
+                                                1 << 20, false);
+        hint_writer.open(hint_file(output_id),
+                         std::ios::binary | std::ios::out | std::ios::trunc);
+      }
+
+      std::string buffer = readers.at(entry->file_id)->ReadAt(entry->record_offset,
+                                                              entry->record_size);
+      BitcaskLayout layout(0);
+      size_t key_size = key->length();
+      size_t value_size = entry->record_size - BitcaskLayout::GetRecordSize(key_size, 0);
+      uint32_t checksum =
+          ByteOrder::fromBigEndian<uint32_t>(buffer.data() + layout.GetChecksumOffset());
+      if (crc32_checksum(buffer.data() + layout.GetKeyOffset(), key_size + value_size) !=
+          checksum) {
+        throw Exception("Corrupted record in data file " + std::to_string(entry->file_id) +
+                        " at offset " + std::to_string(entry->record_offset));
+      }
+
+      size_t record_offset = writer->GetSize();
+      buffer.replace(buffer.length() - sizeof(size_t), sizeof(size_t),
+                     ByteOrder::toBigEndianString<size_t>(record_offset));
+      writer->Append(buffer.data(), buffer.length());
+
+      std::string hint;
+      Bitcask::encode_hint(hint, *key, entry->record_size, record_offset);
+      hint_writer.write(hint.data(), hint.length());
+    }
+    seal();
+  });
+  readers.clear();
+  std::sort(summary.output_files.begin(), summary.output_files.end());
+  sync_path(storage_dir, true);
+  if (!cold_outputs.empty()) {
+    sync_path(cold_storage_dir, true);
+  }
+
+  // the outputs replace the inputs in a single manifest edit
+  std::map<uint64_t, ManifestFile> merged;
+  for (uint64_t file_id : summary.output_files) {
+    bool cold = cold_outputs.count(file_id) > 0;
+    ManifestFile file{file_id, fs::file_size(data_file(file_id, cold)), true, true, false, cold};
+    manifest.Seal(file_id, file.size, true, false, cold);
+    merged.emplace(file_id, file);
+    summary.output_size += file.size;
+  }
+  manifest.CommitMerge(summary.output_files, file_ids);
+  max_file_id = next_id - 1;
+
+  // the commit made the inputs obsolete, a removal cut short by a crash is
+  // finished by the next open
+  for (uint64_t file_id : file_ids) {
+    fs::remove(data_file(file_id));
+    fs::remove(hint_file(file_id));
+    fs::remove(index_file(file_id));
+  }
+  file_ids = summary.output_files;
+  files = std::move(merged);
+  return summary;
+}
+
+std::map<std::string, BitcaskEntry> OfflineStorage::latest_entries(uint64_t file_id) {
+  std::map<std::string, BitcaskEntry> entries;
+  if (files.at(file_id).has_hint) {
+    FileHandle reader(hint_file(file_id));
+    std::string hint = reader.ReadAt(0, fs::file_size(hint_file(file_id)));
+    size_t offset = 0;
+    while (offset < hint.length()) {
+      BitcaskLayout layout(offset);
+      if (hint.length() - offset < BitcaskLayout::GetHintRecordSize(0)) {
+        throw Exception("Corrupted hint file " + std::to_string(file_id));
+      }
+      size_t key_size =
+          ByteOrder::fromBigEndian<size_t>(hint.data() + layout.GetHintKeySizeOffset());
+      if (key_size > hint.length() - offset - BitcaskLayout::GetHintRecordSize(0)) {
+        throw Exception("Corrupted hint file " + std::to_string(file_id));
+      }
+      std::string key = hint.substr(layout.GetHintKeyOffset(), key_size);
+      size_t record_size = ByteOrder::fromBigEndian<size_t>(
+          hint.data() + layout.GetHintRecordSizeOffset(key_size));
+      size_t record_offset = ByteOrder::fromBigEndian<size_t>(
+          hint.data() + layout.GetHintRecordOffsetOffset(key_size));
+      entries.insert_or_assign(key, BitcaskEntry(file_id, record_size, record_offset));
+      offset += BitcaskLayout::GetHintRecordSize(key_size);
+    }
+    return entries;
+  }
+
+  RecordReader reader(data_file(file_id), file_id);
+  Record record;
+  while (reader.Next(record)) {
+    if (!record.valid) {
+      throw Exception("Corrupted record in data file " + std::to_string(file_id) +
+                      " at offset " + std::to_string(record.offset));
+    }
+    entries.insert_or_assign(record.key, BitcaskEntry(file_id, record.tombstone ? 0 : record.size,
+                                                      record.offset));
+  }
+  if (!reader.GetError().empty()) {
+    throw Exception("Corrupted data file " + std::to_string(file_id) + ": " + reader.GetError());
+  }
+  return entries;
+}
+
+std::map<std::string, BitcaskEntry> OfflineStorage::build_key_dir(size_t num_threads) {
+  // files are read in parallel then applied oldest first, newer files win
+  std::vector<std::map<std::string, BitcaskEntry>> files(file_ids.size());
+  parallel_for(file_ids.size(), num_threads,
+               [&](size_t i) { files[i] = latest_entries(file_ids[i]); });
+
+  std::map<std::string, BitcaskEntry> key_dir;
+  for (auto &entries : files) {
+    for (auto &[key, entry] : entries) {
+      if (entry.IsTombstone()) {
+        key_dir.erase(key);
+      } else {
+        key_dir.insert_or_assign(key, entry);
+      }
+    }
+    entries.clear();
+  }
+  return key_dir;
+}
+
+void OfflineStorage::write_hint(uint64_t file_id,
+                                const std::map<std::string, BitcaskEntry> &entries) {
+  fs::path temp_path = Bitcask::temp_file(hint_file(file_id));
+  std::ofstream writer(temp_path, std::ios::binary | std::ios::out | std::ios::trunc);
+  std::string buffer;
+  for (const auto &[key, entry] : entries) {
+    Bitcask::encode_hint(buffer, key, entry.record_size, entry.record_offset);
+    if (buffer.length() >= 1 << 20) {
+      writer.write(buffer.data(), buffer.length());
+      buffer.clear();
+    }
+  }
+  writer.write(buffer.data(), buffer.length());
+  writer.close();
+  if (writer.fail()) {
+    throw Exception("Unable to write hint file " + std::to_string(file_id));
+  }
+  sync_path(temp_path);
+  fs::rename(temp_path, hint_file(file_id));
+  sync_path(storage_dir, true);
+}
+
+Record OfflineStorage::read_record(const FileHandle &reader, uint64_t file_id,
+                                   const BitcaskEntry &entry) {
+  std::string buffer = reader.ReadAt(entry.record_offset, entry.record_size);
+  auto [key, value] = Bitcask::decode_record(buffer);
+  BitcaskLayout layout(0);
+  bool valid = crc32_checksum(buffer.data() + layout.GetKeyOffset(),
+                              key.length() + value.length()) ==
+               ByteOrder::fromBigEndian<uint32_t>(buffer.data() + layout.GetChecksumOffset());
+  return Record{file_id, entry.record_offset, entry.record_size, std::move(key),
+                std::move(value), false, valid};
+}
+
+void OfflineStorage::ensure_writable() const {
+  if (read_only) {
+    throw Exception("bitcask storage is opened read only.");
+  }
+}
+
+}  // namespace bitcaskcpp
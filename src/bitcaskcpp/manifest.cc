@@ -0,0 +1,275 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <set>
+
+#include "bitcaskcpp/manifest.h"
+#include "cxxutils/byteorder.h"
+
+namespace bitcaskcpp {
+
+static const uint64_t HAS_HINT = 1;
+static const uint64_t HAS_INDEX = 2;
+static const uint64_t COLD = 4;
+
+static uint64_t hint_flags(bool has_hint, bool has_index) {
+  return (has_hint ? HAS_HINT : 0) | (has_index ? HAS_INDEX : 0);
+}
+
+Manifest::Manifest(const fs::path &storage_dir) : storage_dir{storage_dir}, fd{-1} {}
+
+Manifest::~Manifest() { Close(); }
+
+ManifestState Manifest::Load() {
+  // a temporary log left by a crash is truncated by the next Rewrite, the
+  // temporary files of the data files are the job of their writers
+  return fs::exists(GetPath()) ? replay() : scan();
+}
+
+void Manifest::Rewrite(const ManifestState &state) {
+  std::string buffer;
+  for (const auto &[file_id, file] : state.files) {
+    encode_edit(buffer, ADD, {file_id});
+    if (file.sealed) {
+      encode_edit(buffer, SEAL, {file_id, file.size,
+                                 hint_flags(file.has_hint, file.has_index) | (file.cold ? COLD : 0)});
+    }
+  }
+  for (uint64_t file_id : state.obsolete) {
+    encode_edit(buffer, DROP, {file_id});
+  }
+
+  Close();
+  fs::path temp_path = GetPath();
+  temp_path += ".tmp";
+  int temp_fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (temp_fd < 0) {
+    throw Exception("Unable to create the bitcask manifest: " + std::string(std::strerror(errno)));
+  }
+  fd = temp_fd;
+  try {
+    append(buffer);
+  } catch (...) {
+    Close();
+    throw;
+  }
+  Close();
+  fs::rename(temp_path, GetPath());
+  sync_path(storage_dir, true);
+
+  fd = ::open(GetPath().c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (fd < 0) {
+    throw Exception("Unable to open the bitcask manifest: " + std::string(std::strerror(errno)));
+  }
+}
+
+void Manifest::Close() {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+void Manifest::AddFile(uint64_t file_id) {
+  std::string edit;
+  encode_edit(edit, ADD, {file_id});
+  append(edit);
+}
+
+void Manifest::AddMergeOutput(uint64_t file_id) {
+  std::string edit;
+  encode_edit(edit, MERGE, {file_id});
+  append(edit);
+}
+
+void Manifest::Seal(uint64_t file_id, size_t size, bool has_hint, bool has_index, bool cold) {
+  std::string edit;
+  encode_edit(edit, SEAL, {file_id, size, hint_flags(has_hint, has_index) | (cold ? COLD : 0)});
+  append(edit);
+}
+
+void Manifest::SetHints(uint64_t file_id, bool has_hint, bool has_index) {
+  std::string edit;
+  encode_edit(edit, HINTS, {file_id, hint_flags(has_hint, has_index)});
+  append(edit);
+}
+
+void Manifest::CommitMerge(const std::vector<uint64_t> &outputs,
+                           const std::vector<uint64_t> &inputs) {
+  std::vector<uint64_t> fields{outputs.size()};
+  fields.insert(fields.end(), outputs.begin(), outputs.end());
+  fields.push_back(inputs.size());
+  fields.insert(fields.end(), inputs.begin(), inputs.end());
+  std::string edit;
+  encode_edit(edit, COMMIT, fields);
+  append(edit);
+}
+
+void Manifest::Drop(uint64_t file_id) {
+  std::string edit;
+  encode_edit(edit, DROP, {file_id});
+  append(edit);
+}
+
+ManifestState Manifest::replay() {
+  std::ifstream reader(GetPath(), std::ios::binary);
+  std::string log((std::istreambuf_iterator<char>(reader)), std::istreambuf_iterator<char>());
+  if (reader.bad()) {
+    throw Exception("Unable to read the bitcask manifest.");
+  }
+
+  ManifestState state;
+  std::map<uint64_t, ManifestFile> pending;
+  std::set<uint64_t> obsolete;
+  auto mark_obsolete = [&](uint64_t file_id) {
+    state.files.erase(file_id);
+    pending.erase(file_id);
+    obsolete.insert(file_id);
+  };
+
+  size_t offset = 0;
+  size_t header_size = sizeof(uint32_t) + sizeof(size_t);
+  while (log.length() - offset >= header_size) {
+    uint32_t checksum = ByteOrder::fromBigEndian<uint32_t>(log.data() + offset);
+    size_t payload_size = ByteOrder::fromBigEndian<size_t>(log.data() + offset + sizeof(uint32_t));
+    const char *payload = log.data() + offset + header_size;
+    // a torn or damaged edit ends the log
+    if (payload_size == 0 || payload_size > log.length() - offset - header_size ||
+        (payload_size - 1) % sizeof(uint64_t) != 0 ||
+        crc32_checksum(payload, payload_size) != checksum)
+      break;
+    offset += header_size + payload_size;
+
+    std::vector<uint64_t> fields;
+    for (size_t i = 1; i < payload_size; i += sizeof(uint64_t)) {
+      fields.push_back(ByteOrder::fromBigEndian<uint64_t>(payload + i));
+    }
+    if (fields.empty())
+      break;
+    uint64_t file_id = fields[0];
+    switch (static_cast<EditType>(payload[0])) {
+      case ADD:
+        state.files[file_id] = ManifestFile{file_id, 0, false, false, false, false};
+        break;
+      case MERGE:
+        pending[file_id] = ManifestFile{file_id, 0, false, false, false, false};
+        break;
+      case SEAL:
+      case HINTS: {
+        auto file = state.files.find(file_id);
+        if (file == state.files.end()) {
+          file = pending.find(file_id);
+          if (file == pending.end())
+            break;
+        }
+        uint64_t flags = fields.back();
+        if (payload[0] == SEAL && fields.size() == 3) {
+          file->second.sealed = true;
+          file->second.size = fields[1];
+          file->second.cold = (flags & COLD) != 0;
+        }
+        file->second.has_hint = (flags & HAS_HINT) != 0;
+        file->second.has_index = (flags & HAS_INDEX) != 0;
+        break;
+      }
+      case COMMIT: {
+        size_t num_outputs = fields[0];
+        if (fields.size() < num_outputs + 2 ||
+            fields.size() != num_outputs + 2 + fields[num_outputs + 1])
+          break;
+        for (size_t i = 1; i <= num_outputs; ++i) {
+          auto output = pending.find(fields[i]);
+          if (output != pending.end()) {
+            state.files[fields[i]] = output->second;
+            pending.erase(output);
+          }
+        }
+        for (size_t i = num_outputs + 2; i < fields.size(); ++i) {
+          mark_obsolete(fields[i]);
+        }
+        break;
+      }
+      case DROP:
+        mark_obsolete(file_id);
+        break;
+    }
+  }
+
+  // merges that never committed leave their outputs behind
+  for (const auto &[file_id, _] : pending) {
+    obsolete.insert(file_id);
+  }
+  for (const auto &[file_id, _] : state.files) {
+    obsolete.erase(file_id);
+    state.max_file_id = std::max(state.max_file_id, file_id);
+  }
+  for (uint64_t file_id : obsolete) {
+    state.obsolete.push_back(file_id);
+    state.max_file_id = std::max(state.max_file_id, file_id);
+  }
+  return state;
+}
+
+ManifestState Manifest::scan() {
+  // the newest file is still appended to unless it has a hint or an index
+  std::vector<uint64_t> file_ids;
+  for (auto &p : fs::directory_iterator(storage_dir)) {
+    std::string stem = p.path().stem().string();
+    if (p.path().extension() != ".data" || stem.empty() ||
+        !std::all_of(stem.begin(), stem.end(), [](unsigned char c) { return std::isdigit(c); }))
+      continue;
+    file_ids.push_back(std::stoull(stem));
+  }
+  std::sort(file_ids.begin(), file_ids.end());
+
+  ManifestState state;
+  for (uint64_t file_id : file_ids) {
+    fs::path data_path = storage_dir / (std::to_string(file_id) + ".data");
+    bool has_hint = fs::exists(storage_dir / (std::to_string(file_id) + ".hint"));
+    bool has_index = fs::exists(storage_dir / (std::to_string(file_id) + ".index"));
+    bool sealed = file_id != file_ids.back() || has_hint || has_index;
+    state.files[file_id] = ManifestFile{
+        file_id, sealed ? fs::file_size(data_path) : 0, sealed, has_hint, has_index, false};
+    state.max_file_id = file_id;
+  }
+  return state;
+}
+
+void Manifest::append(const std::string &edit) {
+  if (fd < 0) {
+    throw Exception("The bitcask manifest is not opened.");
+  }
+  size_t done = 0;
+  while (done < edit.length()) {
+    ssize_t n = ::write(fd, edit.data() + done, edit.length() - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      throw Exception("Unable to append to the bitcask manifest: " +
+                      std::string(std::strerror(errno)));
+    }
+    done += n;
+  }
+  if (::fdatasync(fd) != 0) {
+    throw Exception("Unable to sync the bitcask manifest.");
+  }
+}
+
+void Manifest::encode_edit(std::string &buffer, EditType type,
+                           const std::vector<uint64_t> &fields) {
+  std::string payload(1, static_cast<char>(type));
+  for (uint64_t field : fields) {
+    payload.append(ByteOrder::toBigEndianString<uint64_t>(field));
+  }
+  buffer.append(ByteOrder::toBigEndianString<uint32_t>(crc32_checksum(payload.data(), payload.length())));
+  buffer.append(ByteOrder::toBigEndianString<size_t>(payload.length()));
+  buffer.append(payload);
+}
+
+}  // namespace bitcaskcpp
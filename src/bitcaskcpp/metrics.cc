@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "bitcaskcpp/metrics.h"
+
+namespace bitcaskcpp {
+
+uint64_t Counter::Value() const {
+  uint64_t value = 0;
+  for (const auto &stripe : stripes) {
+    value += stripe.value.load(std::memory_order_relaxed);
+  }
+  return value;
+}
+
+uint64_t HistogramSnapshot::Percentile(double percentile) const {
+  if (count == 0)
+    return 0;
+  uint64_t rank = std::max<uint64_t>(
+      static_cast<uint64_t>(std::ceil(percentile / 100.0 * count)), 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen >= rank)
+      return std::min(LatencyHistogram::UpperBound(i), max);
+  }
+  return max;
+}
+
+LatencyHistogram::LatencyHistogram() : stripes{new Stripe[METRICS_STRIPES]} {}
+
+void LatencyHistogram::Record(uint64_t nanos) {
+  Stripe &stripe = stripes[metrics_stripe()];
+  stripe.buckets[BucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+  stripe.count.fetch_add(1, std::memory_order_relaxed);
+  stripe.sum.fetch_add(nanos, std::memory_order_relaxed);
+  uint64_t current = max.load(std::memory_order_relaxed);
+  while (nanos > current &&
+         !max.compare_exchange_weak(current, nanos, std::memory_order_relaxed)) {
+  }
+}
+
+HistogramSnapshot LatencyHistogram::Snapshot() const {
+  HistogramSnapshot snapshot;
+  snapshot.buckets.assign(NUM_BUCKETS, 0);
+  for (size_t s = 0; s < METRICS_STRIPES; ++s) {
+    const Stripe &stripe = stripes[s];
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+      snapshot.buckets[i] += stripe.buckets[i].load(std::memory_order_relaxed);
+    }
+    snapshot.count += stripe.count.load(std::memory_order_relaxed);
+    snapshot.sum += stripe.sum.load(std::memory_order_relaxed);
+  }
+  snapshot.max = max.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+size_t LatencyHistogram::BucketOf(uint64_t value) {
+  if (value < SUB_BUCKETS * 2)
+    return value;
+  int shift = 63 - __builtin_clzll(value) - 4;
+  return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::UpperBound(size_t bucket) {
+  if (bucket < SUB_BUCKETS * 2)
+    return bucket;
+  size_t shift = bucket / SUB_BUCKETS - 1;
+  uint64_t sub_bucket = bucket % SUB_BUCKETS + SUB_BUCKETS;
+  if (shift + 5 >= 64)
+    return UINT64_MAX;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+const char *MetricsRegistry::OperationName(int operation) {
+  static const char *names[] = {"get",    "get_async", "multi_get", "put",
+                                "delete", "scan",      "sync",      "compact"};
+  return names[operation];
+}
+
+BitcaskMetrics MetricsRegistry::Snapshot() const {
+  BitcaskMetrics metrics;
+  for (int operation = 0; operation < NUM_OPERATIONS; ++operation) {
+    metrics.latencies[OperationName(operation)] = latencies[operation].Snapshot();
+  }
+  metrics.bytes_read = io.bytes_read.Value();
+  metrics.bytes_written = io.bytes_written.Value();
+  metrics.read_calls = io.read_calls.Value();
+  metrics.write_calls = io.write_calls.Value();
+  metrics.sync_calls = io.sync_calls.Value();
+  metrics.lock_waits = lock_waits.Value();
+  metrics.lock_wait_nanos = lock_wait_nanos.Value();
+  metrics.memtable_hits = memtable_hits.Value();
+  metrics.buffer_hits = buffer_hits.Value();
+  metrics.inline_hits = inline_hits.Value();
+  metrics.disk_reads = disk_reads.Value();
+  metrics.bloom_checks = bloom_checks.Value();
+  metrics.bloom_negatives = bloom_negatives.Value();
+  metrics.bloom_false_positives = bloom_false_positives.Value();
+  metrics.compactions = compactions.Value();
+  metrics.compaction_running = compaction_running.load();
+  metrics.compaction_bytes_total = compaction_bytes_total.load();
+  metrics.compaction_bytes_done = compaction_bytes_done.load();
+  metrics.file_cache_hits = file_cache.hits.Value();
+  metrics.file_cache_reopens = file_cache.reopens.Value();
+  metrics.file_cache_evictions = file_cache.evictions.Value();
+  metrics.cached_open_files = file_cache.open_files.load();
+  return metrics;
+}
+
+static void write_metric(std::ostringstream &out, const char *name, const char *type,
+                         const char *help) {
+  out << "# HELP bitcask_" << name << " " << help << "\n";
+  out << "# TYPE bitcask_" << name << " " << type << "\n";
+}
+
+std::string BitcaskMetrics::ToPrometheus() const {
+  // bucket bounds in seconds, each histogram bucket is counted under the first
+  // bound above its upper bound
+  static const double bounds[] = {1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3,
+                                  1e-2, 5e-2, 1e-1, 5e-1, 1.0,  5.0,  10.0};
+  std::ostringstream out;
+
+  write_metric(out, "operation_duration_seconds", "histogram",
+               "Latency of the storage operations.");
+  for (const auto &[operation, histogram] : latencies) {
+    size_t bucket = 0;
+    uint64_t cumulative = 0;
+    for (double bound : bounds) {
+      while (bucket < histogram.buckets.size() &&
+             LatencyHistogram::UpperBound(bucket) <= bound * 1e9) {
+        cumulative += histogram.buckets[bucket++];
+      }
+      out << "bitcask_operation_duration_seconds_bucket{operation=\"" << operation
+          << "\",le=\"" << bound << "\"} " << cumulative << "\n";
+    }
+    out << "bitcask_operation_duration_seconds_bucket{operation=\"" << operation
+        << "\",le=\"+Inf\"} " << histogram.count << "\n";
+    out << "bitcask_operation_duration_seconds_sum{operation=\"" << operation << "\"} "
+        << histogram.sum / 1e9 << "\n";
+    out << "bitcask_operation_duration_seconds_count{operation=\"" << operation << "\"} "
+        << histogram.count << "\n";
+  }
+
+  write_metric(out, "read_bytes_total", "counter", "Bytes read from data files.");
+  out << "bitcask_read_bytes_total " << bytes_read << "\n";
+  write_metric(out, "written_bytes_total", "counter", "Bytes written to data files.");
+  out << "bitcask_written_bytes_total " << bytes_written << "\n";
+  write_metric(out, "syscalls_total", "counter", "I/O system calls issued.");
+  out << "bitcask_syscalls_total{call=\"pread\"} " << read_calls << "\n";
+  out << "bitcask_syscalls_total{call=\"pwrite\"} " << write_calls << "\n";
+  out << "bitcask_syscalls_total{call=\"fdatasync\"} " << sync_calls << "\n";
+
+  write_metric(out, "lock_waits_total", "counter", "Contended acquisitions of the storage lock.");
+  out << "bitcask_lock_waits_total " << lock_waits << "\n";
+  write_metric(out, "lock_wait_seconds_total", "counter", "Time spent waiting on the storage lock.");
+  out << "bitcask_lock_wait_seconds_total " << lock_wait_nanos / 1e9 << "\n";
+
+  write_metric(out, "record_reads_total", "counter", "Record reads by the place they were served from.");
+  out << "bitcask_record_reads_total{source=\"memtable\"} " << memtable_hits << "\n";
+  out << "bitcask_record_reads_total{source=\"buffer\"} " << buffer_hits << "\n";
+  out << "bitcask_record_reads_total{source=\"keydir\"} " << inline_hits << "\n";
+  out << "bitcask_record_reads_total{source=\"disk\"} " << disk_reads << "\n";
+  write_metric(out, "bloom_checks_total", "counter", "Sealed index bloom filter probes by result.");
+  out << "bitcask_bloom_checks_total{result=\"negative\"} " << bloom_negatives << "\n";
+  out << "bitcask_bloom_checks_total{result=\"false_positive\"} " << bloom_false_positives << "\n";
+  out << "bitcask_bloom_checks_total{result=\"positive\"} "
+      << bloom_checks - bloom_negatives - bloom_false_positives << "\n";
+
+  write_metric(out, "compactions_total", "counter", "Completed compactions.");
+  out << "bitcask_compactions_total " << compactions << "\n";
+  write_metric(out, "compaction_running", "gauge", "Whether a compaction is in progress.");
+  out << "bitcask_compaction_running " << (compaction_running ? 1 : 0) << "\n";
+  write_metric(out, "compaction_bytes", "gauge", "Live bytes of the current or last compaction.");
+  out << "bitcask_compaction_bytes{state=\"total\"} " << compaction_bytes_total << "\n";
+  out << "bitcask_compaction_bytes{state=\"done\"} " << compaction_bytes_done << "\n";
+
+  write_metric(out, "file_cache_lookups_total", "counter", "Read descriptor lookups of sealed files by result.");
+  out << "bitcask_file_cache_lookups_total{result=\"hit\"} " << file_cache_hits << "\n";
+  out << "bitcask_file_cache_lookups_total{result=\"reopen\"} " << file_cache_reopens << "\n";
+  write_metric(out, "file_cache_evictions_total", "counter", "Read descriptors closed by the file cache.");
+  out << "bitcask_file_cache_evictions_total " << file_cache_evictions << "\n";
+  write_metric(out, "file_cache_open_files", "gauge", "Read descriptors held by the file cache.");
+  out << "bitcask_file_cache_open_files " << cached_open_files << "\n";
+  return out.str();
+}
+
+} // namespace bitcaskcpp
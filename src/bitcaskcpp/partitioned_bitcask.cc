@@ -0,0 +1,398 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <memory>
+#include <queue>
+
+#include "bitcaskcpp/partitioned_bitcask.h"
+
+namespace bitcaskcpp {
+
+void PartitionTask::Wait() {
+  std::unique_lock lock(mutex);
+  condition.wait(lock, [this]() { return done; });
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void PartitionTask::execute() {
+  std::exception_ptr failure;
+  try {
+    run();
+  } catch (...) {
+    failure = std::current_exception();
+  }
+  // the waiter may destroy the task as soon as done is set
+  std::lock_guard lock(mutex);
+  error = failure;
+  done = true;
+  condition.notify_one();
+}
+
+PartitionWorker::PartitionWorker(std::optional<size_t> cpu)
+    : head{nullptr}, tail{nullptr}, stopping{false} {
+  thread = std::thread(&PartitionWorker::run, this);
+  if (cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(*cpu, &cpus);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+  }
+}
+
+PartitionWorker::~PartitionWorker() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+  thread.join();
+}
+
+void PartitionWorker::Enqueue(PartitionTask &task) {
+  {
+    std::lock_guard lock(mutex);
+    task.next = nullptr;
+    if (tail == nullptr) {
+      head = &task;
+    } else {
+      tail->next = &task;
+    }
+    tail = &task;
+  }
+  condition.notify_one();
+}
+
+void PartitionWorker::run() {
+  while (true) {
+    PartitionTask *task;
+    {
+      std::unique_lock lock(mutex);
+      condition.wait(lock, [this]() { return stopping || head != nullptr; });
+      if (head == nullptr)
+        return;
+      task = head;
+      head = task->next;
+      if (head == nullptr) {
+        tail = nullptr;
+      }
+    }
+    task->execute();
+  }
+}
+
+// 64 bits FNV-1a, stable across processes and platforms
+static uint64_t partition_hash(const char *key) {
+  uint64_t h = 14695981039346656037ULL;
+  for (const char *c = key; *c != '\0'; ++c) {
+    h ^= static_cast<unsigned char>(*c);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+struct ScanPage {
+  std::vector<std::pair<std::string, std::string>> items;
+  size_t position = 0;
+  bool exhausted = false;
+};
+
+// scan callbacks carry no context, the page being filled is thread local
+static thread_local ScanPage *filled_page = nullptr;
+
+static int collect_page(std::string key, std::string value) {
+  filled_page->items.emplace_back(std::move(key), std::move(value));
+  return filled_page->items.size() >= PartitionedBitcask::SCAN_PAGE_SIZE ? 1 : 0;
+}
+
+static ScanPage read_page(Bitcask &partition, std::string from) {
+  ScanPage page;
+  filled_page = &page;
+  try {
+    partition.Scan(from.data(), collect_page);
+  } catch (...) {
+    filled_page = nullptr;
+    throw;
+  }
+  filled_page = nullptr;
+  page.exhausted = page.items.size() < PartitionedBitcask::SCAN_PAGE_SIZE;
+  return page;
+}
+
+PartitionedBitcask::PartitionedBitcask(std::vector<std::string> paths,
+                                       BitcaskOption options,
+                                       PartitionOption partition_options)
+    : partition_options{partition_options} {
+  if (paths.empty() || partition_options.num_partitions == 0) {
+    throw Exception("A partitioned bitcask storage needs a path and a partition.");
+  }
+  for (size_t i = 0; i < partition_options.num_partitions; ++i) {
+    partition_paths.push_back(fs::path(paths[i % paths.size()]) /
+                              ("partition-" + std::to_string(i)));
+    partitions.push_back(std::make_unique<Bitcask>(partition_paths.back(), options));
+  }
+}
+
+PartitionedBitcask::PartitionedBitcask(std::string path, BitcaskOption options,
+                                       PartitionOption partition_options)
+    : PartitionedBitcask(std::vector<std::string>{path}, options, partition_options) {}
+
+PartitionedBitcask::~PartitionedBitcask() { workers.clear(); }
+
+void PartitionedBitcask::Open() {
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    check_layout(i);
+  }
+
+  if (partition_options.pin_workers) {
+    size_t num_cpus = std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+    for (size_t i = 0; i < partitions.size(); ++i) {
+      std::optional<size_t> cpu;
+      if (partition_options.set_cpu_affinity) {
+        cpu = i % num_cpus;
+      }
+      workers.push_back(std::make_unique<PartitionWorker>(cpu));
+    }
+  }
+  execute_all([](Bitcask &partition, size_t) { partition.Open(); }, true);
+}
+
+void PartitionedBitcask::Close() {
+  execute_all([](Bitcask &partition, size_t) { partition.Close(); }, true);
+  workers.clear();
+}
+
+void PartitionedBitcask::Put(const char *key, const char *value) {
+  execute<void>(PartitionOf(key), [key, value](Bitcask &partition) { partition.Put(key, value); });
+}
+
+bool PartitionedBitcask::Has(const char *key) {
+  return execute<bool>(PartitionOf(key), [key](Bitcask &partition) { return partition.Has(key); });
+}
+
+std::string PartitionedBitcask::Get(const char *key) {
+  return execute<std::string>(PartitionOf(key),
+                              [key](Bitcask &partition) { return partition.Get(key); });
+}
+
+void PartitionedBitcask::Delete(const char *key) {
+  execute<void>(PartitionOf(key), [key](Bitcask &partition) { partition.Delete(key); });
+}
+
+std::vector<std::optional<std::string>>
+PartitionedBitcask::MultiGet(const std::vector<std::string> &keys) {
+  std::vector<std::vector<size_t>> groups(partitions.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    groups[PartitionOf(keys[i].c_str())].push_back(i);
+  }
+
+  // one batched read per partition
+  std::vector<std::optional<std::string>> values(keys.size());
+  execute_all(
+      [&](Bitcask &partition, size_t index) {
+        if (groups[index].empty())
+          return;
+        std::vector<std::string> batch;
+        for (size_t i : groups[index]) {
+          batch.push_back(keys[i]);
+        }
+        std::vector<std::optional<std::string>> found = partition.MultiGet(batch);
+        for (size_t i = 0; i < found.size(); ++i) {
+          values[groups[index][i]] = std::move(found[i]);
+        }
+      },
+      false);
+  return values;
+}
+
+size_t PartitionedBitcask::Size() {
+  size_t size = 0;
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    size += execute<size_t>(i, [](Bitcask &partition) { return partition.Size(); });
+  }
+  return size;
+}
+
+void PartitionedBitcask::Scan(char *prefix, scan_callback_t func) {
+  assert(prefix != nullptr);
+  assert(func != nullptr);
+
+  // k-way merge of the partitions, keys are unique across them
+  std::vector<ScanPage> pages(partitions.size());
+  auto fetch = [&](size_t index, std::string from) {
+    pages[index] = execute<ScanPage>(
+        index, [&from](Bitcask &partition) { return read_page(partition, from); });
+  };
+  typedef std::pair<std::string, size_t> head_t;
+  std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> heads;
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    fetch(i, prefix);
+    if (!pages[i].items.empty()) {
+      heads.push({pages[i].items.front().first, i});
+    }
+  }
+
+  while (!heads.empty()) {
+    size_t index = heads.top().second;
+    heads.pop();
+    ScanPage &page = pages[index];
+    const auto &[key, value] = page.items[page.position++];
+    if (func(key, value) != 0)
+      return;
+
+    if (page.position == page.items.size()) {
+      if (page.exhausted)
+        continue;
+      // keys hold no NUL byte, key + "\x01" is the next possible key
+      std::string next = key + '\x01';
+      fetch(index, next);
+      if (pages[index].items.empty())
+        continue;
+    }
+    heads.push({pages[index].items[pages[index].position].first, index});
+  }
+}
+
+void PartitionedBitcask::Sync() {
+  execute_all([](Bitcask &partition, size_t) { partition.Sync(); }, true);
+}
+
+void PartitionedBitcask::Compact() {
+  execute_all([](Bitcask &partition, size_t) { partition.Compact(); }, true);
+}
+
+BitcaskStats PartitionedBitcask::Statistics() {
+  BitcaskStats total(0, 0, 0, 0);
+  for (const auto &stats : PartitionStatistics()) {
+    total.disposable += stats.disposable;
+    total.total += stats.total;
+    total.num_files += stats.num_files;
+    total.num_entries += stats.num_entries;
+    total.num_inline_values += stats.num_inline_values;
+    total.inline_memory += stats.inline_memory;
+  }
+  return total;
+}
+
+std::vector<BitcaskStats> PartitionedBitcask::PartitionStatistics() {
+  std::vector<BitcaskStats> stats;
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    stats.push_back(
+        execute<BitcaskStats>(i, [](Bitcask &partition) { return partition.Statistics(); }));
+  }
+  return stats;
+}
+
+std::vector<BitcaskMetrics> PartitionedBitcask::PartitionMetrics() {
+  std::vector<BitcaskMetrics> metrics;
+  for (auto &partition : partitions) {
+    metrics.push_back(partition->Metrics());
+  }
+  return metrics;
+}
+
+size_t PartitionedBitcask::PartitionOf(const char *key) const {
+  assert(key != nullptr);
+  return partition_hash(key) % partitions.size();
+}
+
+void PartitionedBitcask::execute_all(const std::function<void(Bitcask &, size_t)> &task,
+                                     bool spawn) {
+  struct PartitionCall : PartitionTask {
+    const std::function<void(Bitcask &, size_t)> *task;
+    Bitcask *partition;
+    size_t index;
+
+    void run() override { (*task)(*partition, index); }
+  };
+
+  std::exception_ptr error;
+  auto record = [&error](std::exception_ptr failure) {
+    if (!error) {
+      error = failure;
+    }
+  };
+  if (!workers.empty()) {
+    // a worker serves its own partition inline, it cannot wait on itself
+    auto calls = std::make_unique<PartitionCall[]>(partitions.size());
+    size_t current = partitions.size();
+    for (size_t i = 0; i < partitions.size(); ++i) {
+      if (workers[i]->IsCurrent()) {
+        current = i;
+        continue;
+      }
+      calls[i].task = &task;
+      calls[i].partition = partitions[i].get();
+      calls[i].index = i;
+      workers[i]->Enqueue(calls[i]);
+    }
+    if (current < partitions.size()) {
+      try {
+        task(*partitions[current], current);
+      } catch (...) {
+        record(std::current_exception());
+      }
+    }
+    // every task completes before the first failure is reported
+    for (size_t i = 0; i < partitions.size(); ++i) {
+      if (i == current)
+        continue;
+      try {
+        calls[i].Wait();
+      } catch (...) {
+        record(std::current_exception());
+      }
+    }
+  } else if (spawn) {
+    std::vector<std::future<void>> results;
+    for (size_t i = 0; i < partitions.size(); ++i) {
+      results.push_back(
+          std::async(std::launch::async, [this, i, &task]() { task(*partitions[i], i); }));
+    }
+    for (auto &result : results) {
+      try {
+        result.get();
+      } catch (...) {
+        record(std::current_exception());
+      }
+    }
+  } else {
+    for (size_t i = 0; i < partitions.size(); ++i) {
+      task(*partitions[i], i);
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void PartitionedBitcask::check_layout(size_t partition) {
+  // a different partition count would send the keys to other partitions
+  fs::create_directories(partition_paths[partition]);
+  fs::path layout_path = partition_paths[partition] / LAYOUT_FILE;
+  std::string expected =
+      std::to_string(partition) + " " + std::to_string(partitions.size());
+  if (fs::exists(layout_path)) {
+    std::ifstream reader(layout_path);
+    std::string layout;
+    std::getline(reader, layout);
+    if (layout != expected) {
+      throw Exception("Partition " + partition_paths[partition].string() +
+                      " was created with a different layout (" + layout + ").");
+    }
+    return;
+  }
+
+  std::ofstream writer(layout_path, std::ios::out | std::ios::trunc);
+  writer << expected << "\n";
+  writer.close();
+  if (writer.fail()) {
+    throw Exception("Unable to write the partition layout.");
+  }
+}
+
+}  // namespace bitcaskcpp
@@ -0,0 +1,98 @@
+#include <algorithm>
+
+#include "bitcaskcpp/record_reader.h"
+#include "cxxutils/byteorder.h"
+
+namespace bitcaskcpp {
+
+RecordReader::RecordReader(const fs::path &file_path, uint64_t file_id, size_t buffer_size,
+                           IOCounters *counters)
+    : reader{file_path, counters}, file_id{file_id}, file_size{fs::file_size(file_path)},
+      position{0}, buffer_offset{0}, buffer_length{0}, buffer_size{buffer_size},
+      batch_index{0} {}
+
+bool RecordReader::Next(Record &record) {
+  if (batch_index == batch.size()) {
+    batch_index = 0;
+    if (!NextBatch(batch))
+      return false;
+  }
+
+  const RecordView &view = batch[batch_index++];
+  record.file_id = file_id;
+  record.offset = view.offset;
+  record.size = view.size;
+  record.key.assign(view.key);
+  record.value.assign(view.value);
+  record.tombstone = view.tombstone;
+  record.valid = view.valid;
+  return true;
+}
+
+bool RecordReader::NextBatch(std::vector<RecordView> &records) {
+  records.clear();
+  while (records.empty() && position < file_size && error.empty()) {
+    size_t wanted = decode(records);
+    if (wanted > 0) {
+      fill(wanted);
+    }
+  }
+  return !records.empty();
+}
+
+size_t RecordReader::decode(std::vector<RecordView> &records) {
+  // record boundaries only come from the size headers, each record is visited
+  // once and checksummed where it lies in the buffer
+  BitcaskLayout layout(0);
+  while (position < file_size) {
+    size_t remaining = file_size - position;
+    if (remaining < BitcaskLayout::GetRecordSize(0, 0)) {
+      error = "truncated record at offset " + std::to_string(position);
+      return 0;
+    }
+    size_t available = buffer_offset + buffer_length - position;
+    if (available < layout.GetKeyOffset())
+      return records.empty() ? layout.GetKeyOffset() : 0;
+
+    const char *data = buffer.data() + (position - buffer_offset);
+    size_t key_size = ByteOrder::fromBigEndian<size_t>(data + layout.GetKeySizeOffset());
+    size_t value_size = ByteOrder::fromBigEndian<size_t>(data + layout.GetValueSizeOffset());
+    if (key_size > remaining || value_size > remaining ||
+        BitcaskLayout::GetRecordSize(key_size, value_size) > remaining) {
+      error = "record at offset " + std::to_string(position) + " overruns the file";
+      return 0;
+    }
+    size_t record_size = BitcaskLayout::GetRecordSize(key_size, value_size);
+    if (available < record_size)
+      return records.empty() ? record_size : 0;
+
+    RecordView view;
+    view.offset = position;
+    view.size = record_size;
+    view.data = data;
+    view.key = std::string_view(data + layout.GetKeyOffset(), key_size);
+    view.value = std::string_view(data + layout.GetValueOffset(key_size), value_size);
+    view.tombstone = view.value == Bitcask::TOMBSTONE;
+    view.valid =
+        crc32_checksum(data + layout.GetKeyOffset(), key_size + value_size) ==
+            ByteOrder::fromBigEndian<uint32_t>(data + layout.GetChecksumOffset()) &&
+        ByteOrder::fromBigEndian<size_t>(data + layout.GetOffsetOffset(key_size, value_size)) ==
+            position;
+    records.push_back(view);
+    position += record_size;
+  }
+  return 0;
+}
+
+void RecordReader::fill(size_t size) {
+  // the buffer restarts at the first record not decoded, a record larger than
+  // the buffer grows it
+  buffer_offset = position;
+  buffer_length = std::max(size, std::min(buffer_size, file_size - position));
+  if (buffer.size() < buffer_length) {
+    buffer.resize(buffer_length);
+  }
+  reader.ReadAt(position, buffer.data(), buffer_length);
+}
+
+}  // namespace bitcaskcpp
@@ -0,0 +1,484 @@
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <tuple>
+
+#include "bitcaskcpp/replication.h"
+
+namespace bitcaskcpp {
+
+/*
+Frames of the replication stream, integers are big endian:
+
+  reset         'R'
+  file          'F' | file_id | size | data
+  snapshot end  'S' | file_id | offset
+  change        'C' | file_id | offset | key_sz | value_sz | tombstone | key | value
+  heartbeat     'H' | shipped file_id | offset | leader end file_id | offset
+*/
+static const char FRAME_RESET = 'R';
+static const char FRAME_FILE = 'F';
+static const char FRAME_SNAPSHOT_END = 'S';
+static const char FRAME_CHANGE = 'C';
+static const char FRAME_HEARTBEAT = 'H';
+
+// frames are sent in batches of about this size
+static const size_t BATCH_SIZE = 64 * 1024;
+
+static void send_all(int socket, const char *data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = ::send(socket, data + done, size - done, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      throw Exception("Unable to send to the replica: " + std::string(std::strerror(errno)));
+    }
+    done += n;
+  }
+}
+
+static void append_position(std::string &buffer, const LogPosition &position) {
+  buffer.append(ByteOrder::toBigEndianString<uint64_t>(position.file_id));
+  buffer.append(ByteOrder::toBigEndianString<size_t>(position.offset));
+}
+
+static bool precedes(const LogPosition &a, const LogPosition &b) {
+  return std::tie(a.file_id, a.offset) < std::tie(b.file_id, b.offset);
+}
+
+/*
+Buffered reads of the stream, a closed stream fails unless it ends between two
+frames.
+*/
+class StreamReader {
+ public:
+  explicit StreamReader(int socket) : socket{socket}, begin{0}, end{0}, buffer(BATCH_SIZE, '\0') {}
+
+  bool AtEnd() { return begin == end && !fill(); }
+
+  void Read(char *data, size_t size) {
+    while (size > 0) {
+      if (begin == end && !fill()) {
+        throw Exception("The replication stream ended in the middle of a frame.");
+      }
+      size_t n = std::min(size, end - begin);
+      std::memcpy(data, buffer.data() + begin, n);
+      begin += n;
+      data += n;
+      size -= n;
+    }
+  }
+
+  template <typename T>
+  T Read() {
+    char data[sizeof(T)];
+    Read(data, sizeof(T));
+    return ByteOrder::fromBigEndian<T>(data);
+  }
+
+  LogPosition ReadPosition() {
+    uint64_t file_id = Read<uint64_t>();
+    size_t offset = Read<size_t>();
+    return LogPosition{file_id, offset};
+  }
+
+  std::string ReadString(size_t size) {
+    std::string data(size, '\0');
+    Read(data.data(), size);
+    return data;
+  }
+
+ private:
+  int socket;
+  size_t begin;
+  size_t end;
+  std::string buffer;
+
+  bool fill() {
+    while (true) {
+      ssize_t n = ::read(socket, buffer.data(), buffer.size());
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        throw Exception("Unable to read the replication stream: " +
+                        std::string(std::strerror(errno)));
+      }
+      begin = 0;
+      end = n;
+      return n > 0;
+    }
+  }
+};
+
+LogShipper::LogShipper(Bitcask &leader, int socket, ReplicaOption options)
+    : leader{leader}, socket{socket}, options{options}, stopping{false} {}
+
+LogShipper::~LogShipper() { Stop(); }
+
+void LogShipper::Start() {
+  if (thread.joinable()) {
+    throw Exception("The log shipper is already started.");
+  }
+  stopping = false;
+  thread = std::thread(&LogShipper::run, this);
+}
+
+void LogShipper::Stop() {
+  stopping = true;
+  {
+    std::lock_guard lock(mutex);
+    if (tail != nullptr) {
+      tail->Stop();
+    }
+  }
+  ::shutdown(socket, SHUT_RDWR);
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+std::string LogShipper::GetError() {
+  std::lock_guard lock(mutex);
+  return error;
+}
+
+void LogShipper::run() {
+  try {
+    StreamReader reader(socket);
+    LogPosition from = reader.ReadPosition();
+    bool bootstrap = from.file_id == 0;
+    while (!stopping) {
+      if (bootstrap) {
+        from = send_snapshot();
+        bootstrap = false;
+      }
+      {
+        std::lock_guard lock(mutex);
+        if (stopping)
+          break;
+        tail = leader.Tail(from);
+      }
+
+      try {
+        std::string batch;
+        while (true) {
+          auto timeout = batch.empty()
+                             ? std::chrono::milliseconds(options.heartbeat_interval_ms)
+                             : std::chrono::milliseconds(0);
+          std::optional<LogChange> change = tail->Next(timeout);
+          if (stopping)
+            break;
+          // the follower still holds the files the compaction rewrote, it
+          // starts over from the compacted ones
+          if (tail->GetNumCompactions() > 0) {
+            bootstrap = true;
+            break;
+          }
+          if (!change) {
+            // the tail caught up, ship what is pending or tell we are alive
+            if (batch.empty()) {
+              batch.push_back(FRAME_HEARTBEAT);
+              append_position(batch, tail->GetPosition());
+              append_position(batch, leader.LogEnd());
+            }
+            send_all(socket, batch.data(), batch.length());
+            batch.clear();
+            continue;
+          }
+
+          const char *value = change->value ? change->value->c_str() : Bitcask::TOMBSTONE;
+          size_t value_size = std::strlen(value);
+          batch.push_back(FRAME_CHANGE);
+          append_position(batch, change->position);
+          batch.append(ByteOrder::toBigEndianString<size_t>(change->key.length()));
+          batch.append(ByteOrder::toBigEndianString<size_t>(value_size));
+          batch.push_back(change->value ? 0 : 1);
+          batch.append(change->key);
+          batch.append(value, value_size);
+          if (batch.length() >= BATCH_SIZE) {
+            send_all(socket, batch.data(), batch.length());
+            batch.clear();
+          }
+        }
+        if (!bootstrap)
+          break;
+      } catch (const Exception &) {
+        // the position was compacted away, unless the leader or the follower
+        // went away in which case bootstrapping fails too
+        if (stopping)
+          break;
+        bootstrap = true;
+      }
+    }
+  } catch (const std::exception &e) {
+    std::lock_guard lock(mutex);
+    if (!stopping) {
+      error = e.what();
+    }
+  }
+
+  std::lock_guard lock(mutex);
+  tail.reset();
+}
+
+LogPosition LogShipper::send_snapshot() {
+  LogPosition end;
+  std::vector<SealedFile> files = leader.sealed_files(end);
+
+  std::string frame(1, FRAME_RESET);
+  send_all(socket, frame.data(), frame.length());
+  std::string buffer(BATCH_SIZE * 16, '\0');
+  for (const auto &file : files) {
+    frame.assign(1, FRAME_FILE);
+    frame.append(ByteOrder::toBigEndianString<uint64_t>(file.file_id));
+    frame.append(ByteOrder::toBigEndianString<size_t>(file.size));
+    send_all(socket, frame.data(), frame.length());
+    for (size_t offset = 0; offset < file.size && !stopping; offset += buffer.size()) {
+      size_t size = std::min(buffer.size(), file.size - offset);
+      file.reader->ReadAt(offset, buffer.data(), size);
+      send_all(socket, buffer.data(), size);
+    }
+  }
+  frame.assign(1, FRAME_SNAPSHOT_END);
+  append_position(frame, end);
+  send_all(socket, frame.data(), frame.length());
+  return end;
+}
+
+static BitcaskOption follower_options(BitcaskOption options) {
+  // the leader decides where records go, every write reaches the log at once
+  options.max_file_size = 0;
+  options.memtable_size = 0;
+  return options;
+}
+
+Follower::Follower(std::string path, int socket, BitcaskOption options,
+                   ReplicaOption replica_options)
+    : storage_dir{fs::path(path)}, socket{socket}, replica_options{replica_options},
+      storage{path, follower_options(options)}, stopping{false}, opened{false},
+      last_contact{std::chrono::steady_clock::now()}, num_bootstraps{0}, connected{false} {}
+
+Follower::~Follower() {
+  Stop();
+  if (opened) {
+    storage.Close();
+  }
+}
+
+void Follower::Start() {
+  if (thread.joinable()) {
+    throw Exception("The follower is already started.");
+  }
+
+  // data left by a previous run is resumed from its end
+  bool has_data = false;
+  if (fs::exists(storage_dir)) {
+    for (auto &p : fs::directory_iterator(storage_dir)) {
+      has_data |= p.path().extension() == Bitcask::DATA_FILE_EXTENTION;
+    }
+  }
+  if (has_data && !opened) {
+    storage.Open();
+    opened = true;
+  }
+  {
+    std::lock_guard lock(mutex);
+    applied = opened ? storage.LogEnd() : LogPosition{};
+    last_contact = std::chrono::steady_clock::now();
+    connected = true;
+    error.clear();
+  }
+
+  std::string hello;
+  append_position(hello, applied);
+  send_all(socket, hello.data(), hello.length());
+  stopping = false;
+  thread = std::thread(&Follower::run, this);
+}
+
+void Follower::Stop() {
+  stopping = true;
+  ::shutdown(socket, SHUT_RDWR);
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+bool Follower::Has(const char *key) {
+  ensure_fresh();
+  return storage.Has(key);
+}
+
+std::string Follower::Get(const char *key) {
+  ensure_fresh();
+  return storage.Get(key);
+}
+
+std::vector<std::optional<std::string>>
+Follower::MultiGet(const std::vector<std::string> &keys) {
+  ensure_fresh();
+  return storage.MultiGet(keys);
+}
+
+size_t Follower::Size() {
+  ensure_fresh();
+  return storage.Size();
+}
+
+void Follower::Scan(char *prefix, scan_callback_t func) {
+  ensure_fresh();
+  storage.Scan(prefix, func);
+}
+
+ReplicaStatus Follower::Status() {
+  std::lock_guard lock(mutex);
+  ReplicaStatus status;
+  status.applied = applied;
+  status.leader_end = leader_end;
+  if (applied.file_id == leader_end.file_id) {
+    status.lag_bytes = leader_end.offset - std::min(leader_end.offset, applied.offset);
+  } else if (precedes(leader_end, applied)) {
+    status.lag_bytes = 0;
+  }
+  status.since_contact = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - last_contact);
+  status.num_bootstraps = num_bootstraps;
+  status.connected = connected;
+  status.error = error;
+  return status;
+}
+
+bool Follower::WaitFor(LogPosition position, std::chrono::milliseconds timeout) {
+  std::unique_lock lock(mutex);
+  return applied_condition.wait_for(lock, timeout, [&]() {
+    return opened && !precedes(applied, position);
+  });
+}
+
+void Follower::run() {
+  try {
+    StreamReader reader(socket);
+    while (!stopping && !reader.AtEnd()) {
+      char type;
+      reader.Read(&type, 1);
+      if (type == FRAME_RESET) {
+        reset();
+      } else if (type == FRAME_FILE) {
+        uint64_t file_id = reader.Read<uint64_t>();
+        size_t size = reader.Read<size_t>();
+        fs::path file_path = storage_dir / (std::to_string(file_id) + Bitcask::DATA_FILE_EXTENTION +
+                                            Bitcask::TEMP_FILE_EXTENTION);
+        std::ofstream writer(file_path, std::ios::binary | std::ios::out | std::ios::trunc);
+        std::string chunk;
+        for (size_t done = 0; done < size; done += chunk.length()) {
+          chunk = reader.ReadString(std::min(size - done, BATCH_SIZE));
+          writer.write(chunk.data(), chunk.length());
+        }
+        writer.close();
+        if (writer.fail()) {
+          throw Exception("Unable to write a bootstrapped bitcask file.");
+        }
+        sync_path(file_path);
+        fs::rename(file_path, storage_dir / (std::to_string(file_id) + Bitcask::DATA_FILE_EXTENTION));
+      } else if (type == FRAME_SNAPSHOT_END) {
+        // the tail starts at the beginning of the active file of the leader
+        // the files received are durable before the storage relies on them
+        LogPosition end = reader.ReadPosition();
+        sync_path(storage_dir, true);
+        storage.Open();
+        std::lock_guard lock(mutex);
+        opened = true;
+        num_bootstraps += 1;
+        applied = end;
+        leader_end = end;
+        last_contact = std::chrono::steady_clock::now();
+        applied_condition.notify_all();
+      } else if (type == FRAME_CHANGE) {
+        LogChange change;
+        change.position = reader.ReadPosition();
+        size_t key_size = reader.Read<size_t>();
+        size_t value_size = reader.Read<size_t>();
+        char tombstone;
+        reader.Read(&tombstone, 1);
+        change.key = reader.ReadString(key_size);
+        std::string value = reader.ReadString(value_size);
+        if (tombstone == 0) {
+          change.value = std::move(value);
+        }
+        contact(storage.replay(change), false);
+      } else if (type == FRAME_HEARTBEAT) {
+        // everything before the shipped position was received, it can be
+        // ahead of the local log end when the leader skipped to a new file
+        LogPosition shipped = reader.ReadPosition();
+        contact(shipped, false);
+        contact(reader.ReadPosition(), true);
+      } else {
+        throw Exception("Unknown frame in the replication stream.");
+      }
+    }
+  } catch (const std::exception &e) {
+    std::lock_guard lock(mutex);
+    if (!stopping) {
+      error = e.what();
+    }
+  }
+
+  std::lock_guard lock(mutex);
+  connected = false;
+  applied_condition.notify_all();
+}
+
+void Follower::reset() {
+  {
+    std::lock_guard lock(mutex);
+    if (opened) {
+      opened = false;
+      storage.Close();
+    }
+    applied = LogPosition{};
+  }
+
+  // the leader sends everything again, drop what this follower had
+  fs::create_directories(storage_dir);
+  for (auto &p : fs::directory_iterator(storage_dir)) {
+    auto extension = p.path().extension();
+    if (extension == Bitcask::DATA_FILE_EXTENTION || extension == Bitcask::HINT_FILE_EXTENTION ||
+        extension == Bitcask::INDEX_FILE_EXTENTION || extension == Bitcask::TEMP_FILE_EXTENTION ||
+        p.path().filename() == Manifest::MANIFEST_FILE) {
+      fs::remove(p);
+    }
+  }
+}
+
+void Follower::contact(LogPosition position, bool is_heartbeat) {
+  std::lock_guard lock(mutex);
+  last_contact = std::chrono::steady_clock::now();
+  if (is_heartbeat) {
+    leader_end = position;
+    return;
+  }
+  if (precedes(applied, position)) {
+    applied = position;
+  }
+  if (precedes(leader_end, applied)) {
+    leader_end = applied;
+  }
+  applied_condition.notify_all();
+}
+
+void Follower::ensure_fresh() {
+  if (replica_options.max_staleness_ms == 0)
+    return;
+  std::lock_guard lock(mutex);
+  if (std::chrono::steady_clock::now() - last_contact >
+      std::chrono::milliseconds(replica_options.max_staleness_ms)) {
+    throw Exception("The follower has not heard from its leader for too long.");
+  }
+}
+
+}  // namespace bitcaskcpp
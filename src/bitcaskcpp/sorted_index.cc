@@ -0,0 +1,200 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "bitcaskcpp/common.h"
+#include "bitcaskcpp/sorted_index.h"
+#include "cxxutils/byteorder.h"
+
+namespace bitcaskcpp {
+
+BloomFilter::BloomFilter(size_t num_keys, size_t bits_per_key) {
+  // k = ln(2) * bits per key minimizes the false positive rate
+  num_probes = std::clamp<uint32_t>(
+      static_cast<uint32_t>(std::lround(bits_per_key * 0.69)), 1, 30);
+  size_t num_bits = std::max<size_t>(num_keys * bits_per_key, 64);
+  bits.assign((num_bits + 7) / 8, '\0');
+}
+
+BloomFilter::BloomFilter(std::string bits, uint32_t num_probes)
+    : bits{std::move(bits)}, num_probes{num_probes} {}
+
+void BloomFilter::Add(std::string_view key) {
+  size_t num_bits = bits.size() * 8;
+  uint64_t h = hash(key);
+  uint64_t delta = (h >> 33) | 1;
+  for (uint32_t i = 0; i < num_probes; ++i) {
+    size_t bit = h % num_bits;
+    bits[bit / 8] |= static_cast<char>(1 << (bit % 8));
+    h += delta;
+  }
+}
+
+bool BloomFilter::MayContain(std::string_view key) const {
+  if (bits.empty())
+    return true;
+
+  size_t num_bits = bits.size() * 8;
+  uint64_t h = hash(key);
+  uint64_t delta = (h >> 33) | 1;
+  for (uint32_t i = 0; i < num_probes; ++i) {
+    size_t bit = h % num_bits;
+    if ((bits[bit / 8] & (1 << (bit % 8))) == 0)
+      return false;
+    h += delta;
+  }
+  return true;
+}
+
+uint64_t BloomFilter::hash(std::string_view key) {
+  // fnv-1a with a murmur finalizer, stable across builds as filters are
+  // persisted with the index
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : key) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+SortedIndex::SortedIndex(const fs::path &file_path) {
+  int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw Exception("Unable to open bitcask index file.");
+  }
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < FOOTER_SIZE) {
+    ::close(fd);
+    throw Exception("Invalid bitcask index file.");
+  }
+  data_size = file_stat.st_size;
+  void *mapping = ::mmap(nullptr, data_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    throw Exception("Unable to map bitcask index file.");
+  }
+  data = static_cast<const char *>(mapping);
+
+  const char *footer = data + data_size - FOOTER_SIZE;
+  num_entries = ByteOrder::fromBigEndian<size_t>(footer);
+  size_t offsets_offset = ByteOrder::fromBigEndian<size_t>(footer + sizeof(size_t));
+  size_t bloom_offset = ByteOrder::fromBigEndian<size_t>(footer + sizeof(size_t) * 2);
+  size_t bloom_size = ByteOrder::fromBigEndian<size_t>(footer + sizeof(size_t) * 3);
+  size_t num_probes = ByteOrder::fromBigEndian<size_t>(footer + sizeof(size_t) * 4);
+  if (bloom_offset + bloom_size > data_size ||
+      offsets_offset + num_entries * sizeof(size_t) > bloom_offset) {
+    ::munmap(mapping, data_size);
+    throw Exception("Corrupted bitcask index file.");
+  }
+  offsets = data + offsets_offset;
+  filter = BloomFilter(std::string(data + bloom_offset, bloom_size),
+                       static_cast<uint32_t>(num_probes));
+}
+
+SortedIndex::~SortedIndex() {
+  ::munmap(const_cast<char *>(data), data_size);
+}
+
+std::optional<IndexEntry> SortedIndex::Find(std::string_view key) const {
+  if (!filter.MayContain(key))
+    return std::nullopt;
+  return Search(key);
+}
+
+std::optional<IndexEntry> SortedIndex::Search(std::string_view key) const {
+  size_t position = LowerBound(key);
+  if (position == num_entries || key_at(position) != key)
+    return std::nullopt;
+  return GetEntry(position);
+}
+
+size_t SortedIndex::LowerBound(std::string_view key) const {
+  size_t low = 0;
+  size_t high = num_entries;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (key_at(middle) < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+IndexEntry SortedIndex::GetEntry(size_t position) const {
+  std::string_view key = key_at(position);
+  const char *tail = key.data() + key.size();
+  return IndexEntry{std::string(key),
+                    ByteOrder::fromBigEndian<size_t>(tail),
+                    ByteOrder::fromBigEndian<size_t>(tail + sizeof(size_t)),
+                    tail[sizeof(size_t) * 2] != 0};
+}
+
+std::string_view SortedIndex::key_at(size_t position) const {
+  size_t offset =
+      ByteOrder::fromBigEndian<size_t>(offsets + position * sizeof(size_t));
+  size_t key_size = ByteOrder::fromBigEndian<size_t>(data + offset);
+  return std::string_view(data + offset + sizeof(size_t), key_size);
+}
+
+IndexBuilder::IndexBuilder(const fs::path &file_path, size_t expected_keys,
+                           size_t bits_per_key)
+    : file_path{file_path}, num_entries{0}, size{0},
+      filter{expected_keys, bits_per_key} {
+  temp_path = file_path;
+  temp_path += ".tmp";
+  writer.open(temp_path, std::ios::binary | std::ios::out | std::ios::trunc);
+  if (!writer) {
+    throw Exception("Unable to create bitcask index file.");
+  }
+}
+
+void IndexBuilder::Add(const IndexEntry &entry) {
+  std::string buffer;
+  buffer.append(ByteOrder::toBigEndianString<size_t>(entry.key.size()));
+  buffer.append(entry.key);
+  buffer.append(ByteOrder::toBigEndianString<size_t>(entry.record_size));
+  buffer.append(ByteOrder::toBigEndianString<size_t>(entry.record_offset));
+  buffer.push_back(entry.tombstone ? 1 : 0);
+  writer.write(buffer.data(), buffer.size());
+
+  offsets.append(ByteOrder::toBigEndianString<size_t>(size));
+  filter.Add(entry.key);
+  size += buffer.size();
+  num_entries += 1;
+}
+
+void IndexBuilder::Finish() {
+  size_t offsets_offset = size;
+  size_t bloom_offset = offsets_offset + offsets.size();
+  std::string footer;
+  footer.append(ByteOrder::toBigEndianString<size_t>(num_entries));
+  footer.append(ByteOrder::toBigEndianString<size_t>(offsets_offset));
+  footer.append(ByteOrder::toBigEndianString<size_t>(bloom_offset));
+  footer.append(ByteOrder::toBigEndianString<size_t>(filter.GetBits().size()));
+  footer.append(ByteOrder::toBigEndianString<size_t>(filter.GetNumProbes()));
+
+  writer.write(offsets.data(), offsets.size());
+  writer.write(filter.GetBits().data(), filter.GetBits().size());
+  writer.write(footer.data(), footer.size());
+  writer.close();
+  if (!writer) {
+    throw Exception("Unable to write bitcask index file.");
+  }
+  sync_path(temp_path);
+  fs::rename(temp_path, file_path);
+  sync_path(file_path.parent_path(), true);
+}
+
+} // namespace bitcaskcpp
@@ -1,10 +1,26 @@
+#include <chrono>
 #include <filesystem>
+#include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <catch2/catch.hpp>
 
 #include "bitcaskcpp/bitcask.h"
+#include "bitcaskcpp/log_tail.h"
+#include "bitcaskcpp/maintenance.h"
+#include "bitcaskcpp/manifest.h"
+#include "bitcaskcpp/partitioned_bitcask.h"
+#include "bitcaskcpp/replication.h"
 
 namespace fs = std::filesystem;
 
@@ -160,6 +176,1325 @@ TEST_CASE("CRUD operation on bitcask with close", "[crud-close]") {
     REQUIRE(status == true);
 }
 
+TEST_CASE("Async and batched reads on bitcask", "[async]") {
+    bitcaskcpp::BitcaskOption options;
+    auto io_threads = GENERATE(0, 4);
+    options.io_threads = io_threads;
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+
+        for (auto i = 0; i < 200; ++i) {
+            bitcsk.Put(("key-" + std::to_string(i)).data(), ("value-" + std::to_string(i)).data());
+        }
+        bitcsk.Put("key-7", "updated");
+
+        REQUIRE(bitcsk.GetFuture("key-42").get() == "value-42");
+        REQUIRE(bitcsk.GetFuture("key-7").get() == "updated");
+        REQUIRE_THROWS(bitcsk.GetFuture("not_found").get());
+
+        std::promise<std::string> promise;
+        bitcsk.GetAsync("key-199", [&](std::exception_ptr error, std::string value) {
+            promise.set_value(error == nullptr ? value : "error");
+        });
+        REQUIRE(promise.get_future().get() == "value-199");
+        REQUIRE(bitcsk.Metrics().latencies["get_async"].count == 4);
+
+        if (io_threads > 0) {
+            std::promise<bool> closed;
+            bitcsk.GetAsync("key-100", [&](std::exception_ptr, std::string) {
+                try {
+                    bitcsk.Close();
+                    closed.set_value(true);
+                } catch (const bitcaskcpp::Exception&) {
+                    closed.set_value(false);
+                }
+            });
+            REQUIRE_FALSE(closed.get_future().get());
+        }
+
+        auto values = bitcsk.MultiGet({"key-150", "not_found", "key-7", "key-3", "key-150"});
+        REQUIRE(values.size() == 5);
+        REQUIRE(values[0] == "value-150");
+        REQUIRE(values[1] == std::nullopt);
+        REQUIRE(values[2] == "updated");
+        REQUIRE(values[3] == "value-3");
+        REQUIRE(values[4] == "value-150");
+
+        bitcsk.Close();
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("MultiGet coalesces reads across files", "[multiget]") {
+    bitcaskcpp::BitcaskOption options;
+    options.multiget_coalesce_gap = GENERATE(0, 64, 4096);
+    options.multiget_max_read_size = GENERATE(1, 256, 1 << 20);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+
+        std::vector<std::string> keys;
+        for (auto i = 0; i < 100; ++i) {
+            keys.push_back("key-" + std::to_string(i));
+            bitcsk.Put(keys.back().data(), std::string(i, 'a').data());
+        }
+        bitcsk.Compact();
+        for (auto i = 0; i < 100; i += 3) {
+            bitcsk.Put(keys[i].data(), std::string(i, 'b').data());
+        }
+        bitcsk.Delete("key-50");
+        keys.push_back("not_found");
+
+        auto values = bitcsk.MultiGet(keys);
+        REQUIRE(values.size() == keys.size());
+        for (auto i = 0; i < 100; ++i) {
+            if (i == 50) {
+                REQUIRE(values[i] == std::nullopt);
+                continue;
+            }
+            REQUIRE(values[i] == std::string(i, i % 3 == 0 ? 'b' : 'a'));
+        }
+        REQUIRE(values.back() == std::nullopt);
+
+        bitcsk.Close();
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Reopening bitcask with buffered and direct writes", "[write-modes]") {
+    bitcaskcpp::BitcaskOption options;
+    options.write_buffer_size = GENERATE(0, 4096, 1 << 16);
+    options.direct_io = GENERATE(false, true);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        auto expected = [](int i) { return std::string(i * 37 % 9000, 'a' + i % 26); };
+
+        {
+            bitcaskcpp::Bitcask bitcsk(db_path, options);
+            bitcsk.Open();
+            for (auto i = 0; i < 300; ++i) {
+                bitcsk.Put(("key-" + std::to_string(i)).data(), std::string(i, 'x').data());
+            }
+            for (auto i = 0; i < 300; ++i) {
+                bitcsk.Put(("key-" + std::to_string(i)).data(), expected(i).data());
+                REQUIRE(bitcsk.Get(("key-" + std::to_string(i)).data()) == expected(i));
+            }
+            bitcsk.Delete("key-10");
+            bitcsk.Delete("key-20");
+            REQUIRE(bitcsk.Size() == 298);
+            bitcsk.Close();
+        }
+
+        {
+            bitcaskcpp::Bitcask bitcsk(db_path, options);
+            bitcsk.Open();
+            REQUIRE(bitcsk.Size() == 298);
+            REQUIRE_THROWS(bitcsk.Get("key-10"));
+            REQUIRE_THROWS(bitcsk.Get("key-20"));
+            for (auto i = 21; i < 300; ++i) {
+                REQUIRE(bitcsk.Get(("key-" + std::to_string(i)).data()) == expected(i));
+            }
+            REQUIRE(bitcsk.Statistics().disposable > 0);
+
+            bitcsk.Compact();
+            bitcsk.Put("key-10", "back");
+            bitcsk.Sync();
+            REQUIRE(bitcsk.Statistics().disposable == 0);
+            bitcsk.Close();
+        }
+
+        {
+            bitcaskcpp::Bitcask bitcsk(db_path, options);
+            bitcsk.Open();
+            REQUIRE(bitcsk.Size() == 299);
+            REQUIRE(bitcsk.Get("key-10") == "back");
+            REQUIRE_THROWS(bitcsk.Get("key-20"));
+            for (auto i = 21; i < 300; ++i) {
+                REQUIRE(bitcsk.Get(("key-" + std::to_string(i)).data()) == expected(i));
+            }
+            bitcsk.Close();
+        }
+    });
+
+    REQUIRE(status == true);
+}
+static std::map<std::string, std::string> scanned;
+
+static int collect(std::string key, std::string value) {
+    scanned[key] = value;
+    return 0;
+}
+
+static int collect_five(std::string key, std::string value) {
+    scanned[key] = value;
+    return scanned.size() == 5 ? 1 : 0;
+}
+
+TEST_CASE("Size based rollover and low memory keydir", "[low-memory]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_file_size = 2048;
+    options.low_memory_keydir = GENERATE(false, true);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        std::map<std::string, std::string> model;
+        auto verify = [&](bitcaskcpp::Bitcask& bitcsk) {
+            REQUIRE(bitcsk.Size() == model.size());
+            for (auto i = 0; i < 120; ++i) {
+                auto key = "key-" + std::to_string(i);
+                auto expected = model.find(key);
+                REQUIRE(bitcsk.Has(key.data()) == (expected != model.end()));
+                if (expected != model.end()) {
+                    REQUIRE(bitcsk.Get(key.data()) == expected->second);
+                }
+            }
+            scanned.clear();
+            bitcsk.Scan((char*)"", collect);
+            REQUIRE(scanned == model);
+
+            scanned.clear();
+            bitcsk.Scan((char*)"key-5", collect_five);
+            std::map<std::string, std::string> expected(model.lower_bound("key-5"), model.end());
+            while (expected.size() > 5) {
+                expected.erase(std::prev(expected.end()));
+            }
+            REQUIRE(scanned == expected);
+        };
+
+        std::srand(42);
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        for (auto round = 0; round < 3; ++round) {
+            for (auto i = 0; i < 600; ++i) {
+                auto key = "key-" + std::to_string(std::rand() % 120);
+                if (std::rand() % 4 == 0 && model.count(key) > 0) {
+                    bitcsk.Delete(key.data());
+                    model.erase(key);
+                    continue;
+                }
+                auto value = std::string(std::rand() % 40, 'a' + std::rand() % 26);
+                bitcsk.Put(key.data(), value.data());
+                model[key] = value;
+            }
+            verify(bitcsk);
+            bitcsk.Close();
+
+            bitcsk.Open();
+            verify(bitcsk);
+            if (round == 1) {
+                bitcsk.Compact();
+                verify(bitcsk);
+            }
+        }
+        REQUIRE(bitcsk.Statistics().num_files > 2);
+        auto num_indexes = 0;
+        for (auto& p : fs::directory_iterator(db_path)) {
+            num_indexes += p.path().extension() == ".index" ? 1 : 0;
+        }
+        REQUIRE((num_indexes > 1) == options.low_memory_keydir);
+        bitcsk.Close();
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Memtable absorbs overwrites before they reach the log", "[memtable]") {
+    bitcaskcpp::BitcaskOption options;
+    options.memtable_size = 1 << 20;
+    options.memtable_flush_interval_ms = GENERATE(0, 5);
+    options.max_file_size = GENERATE(0, 2048);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        std::map<std::string, std::string> model;
+        auto verify = [&](bitcaskcpp::Bitcask& bitcsk) {
+            REQUIRE(bitcsk.Size() == model.size());
+            std::vector<std::string> keys;
+            for (auto i = 0; i < 120; ++i) {
+                auto key = "key-" + std::to_string(i);
+                auto expected = model.find(key);
+                REQUIRE(bitcsk.Has(key.data()) == (expected != model.end()));
+                if (expected != model.end()) {
+                    REQUIRE(bitcsk.Get(key.data()) == expected->second);
+                }
+                keys.push_back(key);
+            }
+            auto values = bitcsk.MultiGet(keys);
+            for (auto i = 0; i < 120; ++i) {
+                REQUIRE(values[i].has_value() == (model.count(keys[i]) > 0));
+            }
+            scanned.clear();
+            bitcsk.Scan((char*)"", collect);
+            REQUIRE(scanned == model);
+            REQUIRE(bitcsk.GetFlushError().empty());
+        };
+
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        for (auto i = 0; i < 1000; ++i) {
+            bitcsk.Put("hot", std::to_string(i).data());
+        }
+        bitcsk.Sync();
+        REQUIRE(bitcsk.Get("hot") == "999");
+        REQUIRE(bitcsk.Statistics().total == bitcaskcpp::BitcaskLayout::GetRecordSize(3, 3));
+        bitcsk.Put("transient", "value");
+        bitcsk.Delete("transient");
+        bitcsk.Delete("hot");
+        REQUIRE_THROWS(bitcsk.Get("hot"));
+        REQUIRE_THROWS(bitcsk.Delete("transient"));
+        bitcsk.Close();
+
+        std::srand(7);
+        for (auto round = 0; round < 3; ++round) {
+            options.memtable_size = round == 1 ? 512 : 1 << 20;
+            bitcaskcpp::Bitcask bitcsk(db_path, options);
+            bitcsk.Open();
+            verify(bitcsk);
+            for (auto i = 0; i < 600; ++i) {
+                auto key = "key-" + std::to_string(std::rand() % 120);
+                if (std::rand() % 4 == 0 && model.count(key) > 0) {
+                    bitcsk.Delete(key.data());
+                    model.erase(key);
+                    continue;
+                }
+                auto value = std::string(std::rand() % 40, 'a' + std::rand() % 26);
+                bitcsk.Put(key.data(), value.data());
+                model[key] = value;
+            }
+            verify(bitcsk);
+            if (round == 2) {
+                bitcsk.Compact();
+                REQUIRE(bitcsk.Statistics().disposable == 0);
+                verify(bitcsk);
+            }
+            bitcsk.Close();
+        }
+
+        // synced writes are in the log before they return
+        options.sync_writes = true;
+        bitcaskcpp::Bitcask synced(dir / "synced", options);
+        synced.Open();
+        synced.Put("key", "value");
+        auto put_size = bitcaskcpp::BitcaskLayout::GetRecordSize(3, 5);
+        REQUIRE(synced.Statistics().total == put_size);
+        synced.Delete("key");
+        REQUIRE(synced.Statistics().total ==
+                put_size + bitcaskcpp::BitcaskLayout::GetRecordSize(
+                               3, std::string("BITCASKCPP_TOMBSTONE_VALUE").length()));
+        REQUIRE_FALSE(synced.Has("key"));
+        synced.Close();
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Metrics of bitcask operations", "[metrics]") {
+    bitcaskcpp::BitcaskOption options;
+    options.write_buffer_size = 4096;
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        for (auto i = 0; i < 100; ++i) {
+            bitcsk.Put(("key-" + std::to_string(i)).data(), std::string(100, 'v').data());
+        }
+        bitcsk.Sync();
+        for (auto i = 0; i < 50; ++i) {
+            bitcsk.Get(("key-" + std::to_string(i)).data());
+        }
+        bitcsk.Put("buffered", "value");
+        REQUIRE(bitcsk.Get("buffered") == "value");
+        bitcsk.Delete("key-0");
+        REQUIRE_THROWS(bitcsk.Get("key-0"));
+
+        auto metrics = bitcsk.Metrics();
+        REQUIRE(metrics.latencies["put"].count == 101);
+        REQUIRE(metrics.latencies["get"].count == 52);
+        REQUIRE(metrics.latencies["delete"].count == 1);
+        REQUIRE(metrics.latencies["sync"].count == 1);
+        REQUIRE(metrics.latencies["get"].Percentile(50) <= metrics.latencies["get"].max);
+        REQUIRE(metrics.disk_reads == 50);
+        REQUIRE(metrics.buffer_hits == 1);
+        auto record_size = [](int i) {
+            return bitcaskcpp::BitcaskLayout::GetRecordSize(("key-" + std::to_string(i)).size(), 100);
+        };
+        size_t bytes_read = 0;
+        for (auto i = 0; i < 50; ++i) {
+            bytes_read += record_size(i);
+        }
+        REQUIRE(metrics.bytes_read == bytes_read);
+        REQUIRE(metrics.bytes_written > 100 * 100);
+        REQUIRE(metrics.sync_calls == 1);
+        REQUIRE(metrics.write_calls > 0);
+
+        bitcsk.Compact();
+        metrics = bitcsk.Metrics();
+        REQUIRE(metrics.compactions == 1);
+        REQUIRE_FALSE(metrics.compaction_running);
+        size_t live_size = bitcaskcpp::BitcaskLayout::GetRecordSize(8, 5);
+        for (auto i = 1; i < 100; ++i) {
+            live_size += record_size(i);
+        }
+        REQUIRE(metrics.compaction_bytes_done == live_size);
+
+        auto text = metrics.ToPrometheus();
+        REQUIRE(text.find("bitcask_operation_duration_seconds_count{operation=\"put\"} 101\n") != std::string::npos);
+        REQUIRE(text.find("bitcask_operation_duration_seconds_bucket{operation=\"get\",le=\"+Inf\"} 52\n") != std::string::npos);
+        REQUIRE(text.find("bitcask_record_reads_total{source=\"disk\"} ") != std::string::npos);
+        REQUIRE(text.find("# TYPE bitcask_compactions_total counter") != std::string::npos);
+        bitcsk.Close();
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Offline verify, hint rebuild and merge", "[maintenance]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_file_size = 4096;
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        std::map<std::string, std::string> model;
+        auto verify = [&]() {
+            bitcaskcpp::Bitcask bitcsk(db_path, options);
+            bitcsk.Open();
+            REQUIRE(bitcsk.Size() == model.size());
+            scanned.clear();
+            bitcsk.Scan((char*)"", collect);
+            REQUIRE(scanned == model);
+            for (auto i = 0; i < 200; ++i) {
+                auto key = "key-" + std::to_string(i);
+                REQUIRE(bitcsk.Has(key.data()) == (model.count(key) > 0));
+            }
+            auto stats = bitcsk.Statistics();
+            bitcsk.Close();
+            return stats;
+        };
+
+        std::srand(7);
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        for (auto i = 0; i < 1500; ++i) {
+            auto key = "key-" + std::to_string(std::rand() % 200);
+            if (std::rand() % 3 == 0 && model.count(key) > 0) {
+                bitcsk.Delete(key.data());
+                model.erase(key);
+                continue;
+            }
+            auto value = std::string(1 + std::rand() % 50, 'a' + std::rand() % 26);
+            bitcsk.Put(key.data(), value.data());
+            model[key] = value;
+        }
+        REQUIRE_THROWS(bitcaskcpp::OfflineStorage(db_path));
+        bitcsk.Close();
+        auto disposable = verify().disposable;
+
+        // a read only storage is left as found, a storage without manifest
+        // is listed without getting one
+        {
+            fs::rename(db_path / "MANIFEST", dir / "MANIFEST");
+            bitcaskcpp::OfflineStorage storage(db_path, fs::path(), true);
+            REQUIRE(storage.Verify(2).size() == storage.GetFileIds().size());
+            REQUIRE_THROWS(storage.RebuildHints(2));
+            REQUIRE_THROWS(storage.Merge(2, 0));
+            REQUIRE_FALSE(fs::exists(db_path / "MANIFEST"));
+            fs::rename(dir / "MANIFEST", db_path / "MANIFEST");
+        }
+
+        {
+            bitcaskcpp::OfflineStorage storage(db_path);
+            REQUIRE(storage.GetFileIds().size() > 4);
+            for (const auto& result : storage.Verify(4)) {
+                REQUIRE(result.IsValid());
+                REQUIRE(result.num_records > 0);
+            }
+
+            size_t live_size = 0;
+            size_t num_live = 0;
+            for (const auto& usage : storage.Fragmentation(4)) {
+                REQUIRE(usage.live_size <= usage.total_size);
+                live_size += usage.live_size;
+                num_live += usage.num_live;
+            }
+            REQUIRE(num_live == model.size());
+
+            std::map<std::string, std::string> dumped;
+            storage.ForEachLive(4, [&](const bitcaskcpp::Record& record) {
+                REQUIRE(record.valid);
+                dumped[record.key] = record.value;
+                return true;
+            });
+            REQUIRE(dumped == model);
+
+            auto rebuilt = storage.RebuildHints(4);
+            REQUIRE(rebuilt.size() == storage.GetFileIds().size());
+            REQUIRE(storage.RebuildHints(4).empty());
+        }
+        // deletions recorded in the hints still hide the older versions
+        REQUIRE(verify().disposable == disposable);
+
+        {
+            bitcaskcpp::OfflineStorage storage(db_path);
+            auto summary = storage.Merge(3, 1024);
+            REQUIRE(summary.num_keys == model.size());
+            REQUIRE(summary.output_size < summary.input_size);
+            REQUIRE(summary.output_files.size() > 3);
+            for (const auto& usage : storage.Fragmentation(2)) {
+                REQUIRE(usage.live_size == usage.total_size);
+                REQUIRE(usage.has_hint);
+            }
+        }
+        REQUIRE(verify().disposable == 0);
+
+        // a flipped byte is caught by verify
+        {
+            bitcaskcpp::OfflineStorage storage(db_path);
+            auto file_id = storage.GetFileIds().front();
+            std::fstream file(db_path / (std::to_string(file_id) + ".data"),
+                              std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(bitcaskcpp::BitcaskLayout(0).GetKeyOffset());
+            file.put('#');
+            file.close();
+            auto results = storage.Verify(2);
+            REQUIRE_FALSE(results.front().IsValid());
+            REQUIRE(results.front().first_corrupted == 0);
+            REQUIRE_THROWS(storage.Merge(2, 0));
+        }
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("File cache bounds the open descriptors", "[file-cache]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_file_size = 1024;
+    options.max_open_files = 3;
+    options.io_threads = GENERATE(0, 2);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        auto num_descriptors = []() {
+            return std::distance(fs::directory_iterator("/proc/self/fd"), fs::directory_iterator());
+        };
+        auto baseline = num_descriptors();
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        std::vector<std::string> keys;
+        for (auto i = 0; i < 400; ++i) {
+            keys.push_back("key-" + std::to_string(i));
+            bitcsk.Put(keys.back().data(), ("value-" + std::to_string(i)).data());
+        }
+        REQUIRE(bitcsk.Statistics().num_files > 10);
+
+        auto verify = [&]() {
+            for (auto i = 0; i < 400; i += 7) {
+                REQUIRE(bitcsk.Get(keys[i].data()) == "value-" + std::to_string(i));
+            }
+            auto values = bitcsk.MultiGet(keys);
+            for (auto i = 0; i < 400; ++i) {
+                REQUIRE(*values[i] == "value-" + std::to_string(i));
+            }
+            // the active file, the cached ones and the io engine descriptors
+            REQUIRE(num_descriptors() - baseline <= 1 + 3 + 4);
+        };
+        verify();
+        auto metrics = bitcsk.Metrics();
+        REQUIRE(metrics.file_cache_reopens > 10);
+        REQUIRE(metrics.file_cache_evictions > 0);
+        REQUIRE(metrics.cached_open_files <= 3);
+
+        bitcsk.Close();
+        bitcsk.Open();
+        verify();
+        bitcsk.Compact();
+        verify();
+        REQUIRE(bitcsk.Metrics().file_cache_hits > 0);
+        bitcsk.Close();
+        REQUIRE(num_descriptors() == baseline);
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Partitioned bitcask spreads keys over independent partitions", "[partitioned]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_file_size = 4096;
+    bitcaskcpp::PartitionOption partition_options;
+    partition_options.num_partitions = 4;
+    partition_options.pin_workers = GENERATE(false, true);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        std::vector<std::string> paths{dir / "drive-0", dir / "drive-1"};
+        std::map<std::string, std::string> model;
+        auto verify = [&](bitcaskcpp::PartitionedBitcask& bitcsk) {
+            REQUIRE(bitcsk.Size() == model.size());
+            REQUIRE(bitcsk.Statistics().num_entries == model.size());
+            std::vector<std::string> keys;
+            for (auto i = 0; i < 1000; ++i) {
+                keys.push_back("key-" + std::to_string(i));
+            }
+            auto values = bitcsk.MultiGet(keys);
+            for (auto i = 0; i < 1000; ++i) {
+                auto expected = model.find(keys[i]);
+                REQUIRE(values[i].has_value() == (expected != model.end()));
+                if (expected != model.end()) {
+                    REQUIRE(*values[i] == expected->second);
+                    REQUIRE(bitcsk.Get(keys[i].data()) == expected->second);
+                }
+            }
+            scanned.clear();
+            bitcsk.Scan((char*)"", collect);
+            REQUIRE(scanned == model);
+
+            scanned.clear();
+            bitcsk.Scan((char*)"key-5", collect_five);
+            std::map<std::string, std::string> expected(model.lower_bound("key-5"), model.end());
+            while (expected.size() > 5) {
+                expected.erase(std::prev(expected.end()));
+            }
+            REQUIRE(scanned == expected);
+        };
+
+        bitcaskcpp::PartitionedBitcask bitcsk(paths, options, partition_options);
+        bitcsk.Open();
+        for (auto i = 0; i < 1000; ++i) {
+            auto key = "key-" + std::to_string(i);
+            bitcsk.Put(key.data(), ("value-" + std::to_string(i)).data());
+            model[key] = "value-" + std::to_string(i);
+        }
+        for (auto i = 0; i < 1000; i += 3) {
+            auto key = "key-" + std::to_string(i);
+            bitcsk.Delete(key.data());
+            model.erase(key);
+        }
+        REQUIRE_FALSE(bitcsk.Has("key-0"));
+        REQUIRE_THROWS(bitcsk.Get("key-0"));
+        verify(bitcsk);
+
+        // every partition holds a share of the keys
+        auto partition_stats = bitcsk.PartitionStatistics();
+        REQUIRE(partition_stats.size() == 4);
+        for (const auto& stats : partition_stats) {
+            REQUIRE(stats.num_entries > model.size() / 8);
+        }
+        REQUIRE(fs::exists(fs::path(paths[0]) / "partition-2"));
+        REQUIRE(fs::exists(fs::path(paths[1]) / "partition-3"));
+
+        bitcsk.Compact();
+        REQUIRE(bitcsk.Statistics().disposable == 0);
+        verify(bitcsk);
+        bitcsk.Close();
+
+        bitcsk.Open();
+        verify(bitcsk);
+        bitcsk.Close();
+
+        partition_options.num_partitions = 3;
+        bitcaskcpp::PartitionedBitcask resized(paths, options, partition_options);
+        REQUIRE_THROWS(resized.Open());
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Tailing the log of bitcask", "[tail]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_file_size = 1024;
+    options.write_buffer_size = GENERATE(0, 4096);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        typedef std::pair<std::string, std::optional<std::string>> change_t;
+        auto consume = [](bitcaskcpp::LogTail& tail, size_t count) {
+            std::vector<bitcaskcpp::LogChange> changes;
+            while (changes.size() < count) {
+                auto change = tail.Next(std::chrono::seconds(5));
+                if (!change)
+                    break;
+                changes.push_back(*change);
+            }
+            return changes;
+        };
+
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        bitcsk.Put("before", "tail");
+        auto tail = bitcsk.Tail(bitcsk.LogEnd());
+        REQUIRE_FALSE(tail->Next(std::chrono::milliseconds(10)).has_value());
+
+        // the consumer is woken up as the records are appended, across rollovers
+        std::vector<change_t> expected;
+        std::map<std::string, std::string> model;
+        auto consumer = std::async(std::launch::async, consume, std::ref(*tail), 300);
+        for (auto i = 0; i < 300; ++i) {
+            auto key = "key-" + std::to_string(i % 150);
+            if (i >= 150 && i % 3 == 0) {
+                bitcsk.Delete(key.data());
+                model.erase(key);
+                expected.push_back({key, std::nullopt});
+                continue;
+            }
+            auto value = "value-" + std::to_string(i);
+            bitcsk.Put(key.data(), value.data());
+            model[key] = value;
+            expected.push_back({key, value});
+        }
+        auto changes = consumer.get();
+        REQUIRE(changes.size() == expected.size());
+        for (size_t i = 0; i < changes.size(); ++i) {
+            REQUIRE(change_t{changes[i].key, changes[i].value} == expected[i]);
+        }
+        REQUIRE(changes.back().position.file_id > changes.front().position.file_id);
+        REQUIRE(tail->GetPosition() == bitcsk.LogEnd());
+
+        // stopping wakes up a blocked tail
+        auto blocked = std::async(std::launch::async, [&]() {
+            return tail->Next(std::chrono::seconds(30)).has_value();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        tail->Stop();
+        REQUIRE(blocked.get() == false);
+
+        // positions survive a restart
+        bitcaskcpp::LogPosition middle = changes[200].position;
+        bitcsk.Close();
+        bitcsk.Open();
+        auto resumed = bitcsk.Tail(middle);
+        auto rest = consume(*resumed, 100);
+        REQUIRE(rest.size() == 100);
+        REQUIRE(rest.front().key == changes[200].key);
+        REQUIRE(rest.back().position == changes.back().position);
+        REQUIRE_FALSE(resumed->Next(std::chrono::milliseconds(0)).has_value());
+
+        // up to date tails carry on past a compaction, lagging ones fail
+        auto lagging = bitcsk.Tail(middle);
+        bitcsk.Compact();
+        bitcsk.Put("after", "compaction");
+        auto next = resumed->Next(std::chrono::seconds(5));
+        REQUIRE(next.has_value());
+        REQUIRE(next->key == "after");
+        REQUIRE_THROWS(lagging->Next(std::chrono::milliseconds(0)));
+
+        // a record larger than the first read of a change takes a second one
+        auto large = std::string(10000, 'l');
+        bitcsk.Put("large", large.data());
+        next = resumed->Next(std::chrono::seconds(5));
+        REQUIRE(next.has_value());
+        REQUIRE(next->value == large);
+
+        // the log then starts with a copy of the live keys
+        model["before"] = "tail";
+        model["after"] = "compaction";
+        model["large"] = large;
+        auto replay = bitcsk.Tail();
+        std::map<std::string, std::string> replayed;
+        for (const auto& change : consume(*replay, model.size())) {
+            REQUIRE(change.value.has_value());
+            replayed[change.key] = *change.value;
+        }
+        REQUIRE(replayed == model);
+        bitcsk.Close();
+        REQUIRE_THROWS(replay->Next(std::chrono::milliseconds(0)));
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Follower replicas ship the log of a leader", "[replication]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_file_size = 1024;
+    options.low_memory_keydir = GENERATE(false, true);
+    bitcaskcpp::ReplicaOption replica_options;
+    replica_options.heartbeat_interval_ms = 10;
+    bool status = with("tempdir", [&](fs::path& dir) {
+        std::map<std::string, std::string> model;
+        auto write = [&](bitcaskcpp::Bitcask& leader, int from, int to) {
+            for (auto i = from; i < to; ++i) {
+                auto key = "key-" + std::to_string(i % 150);
+                if (i % 4 == 0 && model.count(key) > 0) {
+                    leader.Delete(key.data());
+                    model.erase(key);
+                    continue;
+                }
+                auto value = "value-" + std::to_string(i);
+                leader.Put(key.data(), value.data());
+                model[key] = value;
+            }
+        };
+        auto verify = [&](bitcaskcpp::Follower& follower) {
+            REQUIRE(follower.Size() == model.size());
+            for (auto i = 0; i < 150; ++i) {
+                auto key = "key-" + std::to_string(i);
+                auto expected = model.find(key);
+                REQUIRE(follower.Has(key.data()) == (expected != model.end()));
+                if (expected != model.end()) {
+                    REQUIRE(follower.Get(key.data()) == expected->second);
+                }
+            }
+            scanned.clear();
+            follower.Scan((char*)"", collect);
+            REQUIRE(scanned == model);
+        };
+        // a replication session over a fresh unix socket pair
+        auto replicate = [&](bitcaskcpp::Bitcask& leader, const std::function<void(bitcaskcpp::Follower&)>& callback) {
+            int sockets[2];
+            REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+            bitcaskcpp::LogShipper shipper(leader, sockets[0], replica_options);
+            bitcaskcpp::Follower follower((dir / "follower").string(), sockets[1], options, replica_options);
+            shipper.Start();
+            follower.Start();
+            callback(follower);
+            follower.Stop();
+            shipper.Stop();
+            ::close(sockets[0]);
+            ::close(sockets[1]);
+        };
+
+        bitcaskcpp::Bitcask leader(dir / "leader", options);
+        leader.Open();
+        write(leader, 0, 300);
+
+        // bootstrapped from the sealed files, then fed by the tail
+        replicate(leader, [&](bitcaskcpp::Follower& follower) {
+            write(leader, 300, 600);
+            REQUIRE(follower.WaitFor(leader.LogEnd(), std::chrono::seconds(5)));
+            verify(follower);
+
+            // a compaction on the leader bootstraps the follower again, which
+            // drops the files it rewrote
+            auto data_files = [&]() {
+                size_t count = 0;
+                for (auto& p : fs::directory_iterator(dir / "follower")) {
+                    count += p.path().extension() == ".data" ? 1 : 0;
+                }
+                return count;
+            };
+            auto files_before = data_files();
+            leader.Compact();
+            write(leader, 600, 700);
+            REQUIRE(follower.WaitFor(leader.LogEnd(), std::chrono::seconds(5)));
+            verify(follower);
+            REQUIRE(data_files() < files_before);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            auto replica_status = follower.Status();
+            REQUIRE(replica_status.connected);
+            REQUIRE(replica_status.num_bootstraps == 2);
+            REQUIRE(replica_status.applied == leader.LogEnd());
+            REQUIRE(replica_status.lag_bytes == std::optional<size_t>(0));
+            REQUIRE_THROWS(follower.Get("key-missing"));
+        });
+
+        // a restarted follower resumes from its own log end
+        write(leader, 700, 800);
+        replicate(leader, [&](bitcaskcpp::Follower& follower) {
+            REQUIRE(follower.WaitFor(leader.LogEnd(), std::chrono::seconds(5)));
+            REQUIRE(follower.Status().num_bootstraps == 0);
+            verify(follower);
+        });
+
+        // unless a compaction removed the files it stopped in
+        write(leader, 800, 900);
+        leader.Compact();
+        replicate(leader, [&](bitcaskcpp::Follower& follower) {
+            REQUIRE(follower.WaitFor(leader.LogEnd(), std::chrono::seconds(5)));
+            REQUIRE(follower.Status().num_bootstraps == 1);
+            verify(follower);
+        });
+
+        // reads of a follower cut from its leader fail past the staleness bound
+        replica_options.max_staleness_ms = 200;
+        replicate(leader, [&](bitcaskcpp::Follower& follower) {
+            REQUIRE(follower.WaitFor(leader.LogEnd(), std::chrono::seconds(5)));
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            verify(follower);
+            follower.Stop();
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            REQUIRE_THROWS(follower.Get("key-1"));
+        });
+        leader.Close();
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Hard link snapshots of a live bitcask", "[snapshot]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_file_size = 1024;
+    options.low_memory_keydir = GENERATE(false, true);
+    options.memtable_size = GENERATE(0, 1 << 20);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        std::map<std::string, std::string> model;
+        auto write = [&](bitcaskcpp::Bitcask& bitcsk, int from, int to) {
+            for (auto i = from; i < to; ++i) {
+                auto key = "key-" + std::to_string(i % 150);
+                if (i % 4 == 0 && model.count(key) > 0) {
+                    bitcsk.Delete(key.data());
+                    model.erase(key);
+                    continue;
+                }
+                auto value = "value-" + std::to_string(i);
+                bitcsk.Put(key.data(), value.data());
+                model[key] = value;
+            }
+        };
+        auto verify = [&](bitcaskcpp::Bitcask& bitcsk, const std::map<std::string, std::string>& expected) {
+            REQUIRE(bitcsk.Size() == expected.size());
+            scanned.clear();
+            bitcsk.Scan((char*)"", collect);
+            REQUIRE(scanned == expected);
+            for (const auto& [key, value] : expected) {
+                REQUIRE(bitcsk.Get(key.data()) == value);
+            }
+        };
+
+        bitcaskcpp::Bitcask bitcsk(dir / "testdb", options);
+        bitcsk.Open();
+        write(bitcsk, 0, 400);
+        bitcsk.Snapshot(dir / "snapshot-0");
+        auto snapshot_model = model;
+        REQUIRE(fs::exists(dir / "snapshot-0" / "SNAPSHOT"));
+        REQUIRE_THROWS(bitcsk.Snapshot(dir / "snapshot-0"));
+
+        // the storage goes on, the snapshot does not see it
+        write(bitcsk, 400, 700);
+        {
+            bitcaskcpp::Bitcask snapshot(dir / "snapshot-0", options);
+            snapshot.Open();
+            verify(snapshot, snapshot_model);
+            // writing to a snapshot leaves the linked files alone
+            snapshot.Put("key-1", "snapshot");
+            snapshot.Delete("key-2");
+            snapshot.Compact();
+            snapshot.Close();
+        }
+        verify(bitcsk, model);
+
+        // snapshots taken while compactions remove the files they link
+        std::vector<std::map<std::string, std::string>> snapshot_models;
+        for (auto i = 1; i <= 4; ++i) {
+            write(bitcsk, 700 + i * 50, 750 + i * 50);
+            auto compaction = std::async(std::launch::async, [&]() { bitcsk.Compact(); });
+            bitcsk.Snapshot(dir / ("snapshot-" + std::to_string(i)));
+            compaction.get();
+            snapshot_models.push_back(model);
+        }
+        size_t num_data_files = 0;
+        for (auto& p : fs::directory_iterator(dir / "testdb")) {
+            num_data_files += p.path().extension() == ".data" ? 1 : 0;
+        }
+        REQUIRE(num_data_files == bitcsk.Statistics().num_files);
+        for (auto i = 1; i <= 4; ++i) {
+            bitcaskcpp::Bitcask snapshot(dir / ("snapshot-" + std::to_string(i)), options);
+            snapshot.Open();
+            verify(snapshot, snapshot_models[i - 1]);
+            snapshot.Close();
+        }
+
+        bitcsk.Close();
+        bitcsk.Open();
+        verify(bitcsk, model);
+        bitcsk.Close();
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Manifest lists the live files of bitcask", "[manifest]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_file_size = 1024;
+    options.low_memory_keydir = GENERATE(false, true);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        std::map<std::string, std::string> model;
+        auto verify = [&]() {
+            bitcaskcpp::Bitcask bitcsk(db_path, options);
+            bitcsk.Open();
+            REQUIRE(bitcsk.Size() == model.size());
+            for (const auto& [key, value] : model) {
+                REQUIRE(bitcsk.Get(key.data()) == value);
+            }
+            bitcsk.Close();
+        };
+
+        {
+            bitcaskcpp::Bitcask bitcsk(db_path, options);
+            bitcsk.Open();
+            for (auto i = 0; i < 200; ++i) {
+                auto key = "key-" + std::to_string(i % 120);
+                auto value = "value-" + std::to_string(i);
+                bitcsk.Put(key.data(), value.data());
+                model[key] = value;
+            }
+            bitcsk.Delete("key-3");
+            model.erase("key-3");
+            bitcsk.Close();
+        }
+        REQUIRE(fs::exists(db_path / "MANIFEST"));
+
+        // files not listed are left alone, even when their name is no id
+        std::ofstream(db_path / "stale.data") << "stale";
+        verify();
+        REQUIRE(fs::exists(db_path / "stale.data"));
+
+        // a merge output that was never committed is removed
+        uint64_t uncommitted;
+        {
+            bitcaskcpp::Manifest manifest(db_path);
+            bitcaskcpp::ManifestState state = manifest.Load();
+            manifest.Rewrite(state);
+            uncommitted = state.max_file_id + 1;
+            manifest.AddMergeOutput(uncommitted);
+            manifest.Close();
+        }
+        auto uncommitted_path = db_path / (std::to_string(uncommitted) + ".data");
+        std::ofstream(uncommitted_path) << "partial merge output";
+        auto uncommitted_hint = db_path / (std::to_string(uncommitted) + ".hint.tmp");
+        std::ofstream(uncommitted_hint) << "partial hint";
+        std::ofstream(db_path / "MANIFEST.tmp") << "partial manifest";
+        verify();
+        REQUIRE_FALSE(fs::exists(uncommitted_path));
+        REQUIRE_FALSE(fs::exists(uncommitted_hint));
+        REQUIRE_FALSE(fs::exists(db_path / "MANIFEST.tmp"));
+
+        // a torn edit at the end of the manifest is ignored
+        std::ofstream(db_path / "MANIFEST", std::ios::app | std::ios::binary) << "torn";
+        verify();
+
+        // compactions commit their output in the manifest, ids keep growing
+        {
+            bitcaskcpp::Bitcask bitcsk(db_path, options);
+            bitcsk.Open();
+            auto end = bitcsk.LogEnd();
+            bitcsk.Compact();
+            bitcsk.Put("key-after", "compaction");
+            model["key-after"] = "compaction";
+            REQUIRE(bitcsk.LogEnd().file_id > end.file_id);
+            bitcsk.Close();
+        }
+        verify();
+        size_t num_data_files = 0;
+        for (auto& p : fs::directory_iterator(db_path)) {
+            num_data_files += p.path().extension() == ".data" ? 1 : 0;
+        }
+        // the compaction output, the active file and stale.data
+        REQUIRE(num_data_files == 3);
+
+        // storages of older versions are listed once then get a manifest
+        fs::remove(db_path / "MANIFEST");
+        fs::remove(db_path / "stale.data");
+        verify();
+        REQUIRE(fs::exists(db_path / "MANIFEST"));
+
+        // a listed file that went missing is reported
+        for (auto& p : fs::directory_iterator(db_path)) {
+            if (p.path().extension() == ".data") {
+                fs::remove(p);
+                break;
+            }
+        }
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        REQUIRE_THROWS(bitcsk.Open());
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Tiered bitcask moves rarely read files to the cold directory", "[tiering]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_file_size = 1024;
+    options.hot_sealed_files = 0;
+    options.cold_max_reads = 2;
+    options.low_memory_keydir = GENERATE(false, true);
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        auto cold_path = dir / "cold";
+        options.cold_storage_dir = cold_path.string();
+        auto data_files = [](const fs::path& path) {
+            std::vector<std::string> files;
+            for (auto& p : fs::directory_iterator(path)) {
+                if (p.path().extension() == ".data") {
+                    files.push_back(p.path().filename().string());
+                }
+            }
+            return files;
+        };
+
+        std::map<std::string, std::string> model;
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        for (auto i = 0; i < 200; ++i) {
+            auto key = "key-" + std::to_string(i);
+            bitcsk.Put(key.data(), ("value-" + std::to_string(i)).data());
+            model[key] = "value-" + std::to_string(i);
+        }
+        auto verify = [&]() {
+            REQUIRE(bitcsk.Size() == model.size());
+            for (const auto& [key, value] : model) {
+                REQUIRE(bitcsk.Get(key.data()) == value);
+            }
+        };
+        REQUIRE(data_files(cold_path).empty());
+
+        // the first keys are read often, their files stay on the fast tier
+        for (auto round = 0; round < 3; ++round) {
+            for (auto i = 0; i < 10; ++i) {
+                auto key = "key-" + std::to_string(i);
+                REQUIRE(bitcsk.Get(key.data()) == model[key]);
+            }
+        }
+        bitcsk.Compact();
+        auto cold_files = data_files(cold_path);
+        REQUIRE(cold_files.size() == 1);
+        REQUIRE(fs::file_size(cold_path / cold_files.front()) > 0);
+        REQUIRE(data_files(db_path).size() == 2);
+        REQUIRE_FALSE(fs::exists(db_path / cold_files.front()));
+        verify();
+
+        bitcsk.Put("key-new", "value-new");
+        model["key-new"] = "value-new";
+        bitcsk.Close();
+
+        // nothing was read since the reopen, only the active file stays hot
+        bitcsk.Open();
+        bitcsk.Compact();
+        REQUIRE(data_files(db_path).size() == 2);
+        REQUIRE(data_files(cold_path).size() == 1);
+        bitcsk.Close();
+
+        // reading the cold records brings them back to the fast tier
+        bitcsk.Open();
+        verify();
+        bitcsk.Compact();
+        cold_files = data_files(cold_path);
+        REQUIRE(cold_files.size() == 1);
+        REQUIRE(fs::file_size(cold_path / cold_files.front()) ==
+                bitcaskcpp::BitcaskLayout::GetRecordSize(7, 9));
+        verify();
+        bitcsk.Close();
+
+        // the offline tools find the cold files through the cold directory
+        REQUIRE_THROWS(bitcaskcpp::OfflineStorage(db_path));
+        {
+            bitcaskcpp::OfflineStorage storage(db_path, cold_path);
+            for (const auto& result : storage.Verify(2)) {
+                REQUIRE(result.IsValid());
+            }
+
+            // a merge keeps the records of cold files on the cold tier
+            storage.Merge(2, 0);
+            cold_files = data_files(cold_path);
+            REQUIRE(cold_files.size() == 1);
+            REQUIRE(fs::file_size(cold_path / cold_files.front()) ==
+                    bitcaskcpp::BitcaskLayout::GetRecordSize(7, 9));
+        }
+        bitcsk.Open();
+        verify();
+        bitcsk.Close();
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Small values are inlined in the keydir", "[inline]") {
+    bitcaskcpp::BitcaskOption options;
+    options.max_inline_value_size = 8;
+    options.inline_values_memory = 10 * 32;
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        std::map<std::string, std::string> model;
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        auto verify = [&]() {
+            for (const auto& [key, value] : model) {
+                REQUIRE(bitcsk.Get(key.data()) == value);
+            }
+            auto values = bitcsk.MultiGet({"key-0", "key-19", "key-missing"});
+            REQUIRE(*values[0] == model["key-0"]);
+            REQUIRE(*values[1] == model["key-19"]);
+            REQUIRE_FALSE(values[2]);
+        };
+
+        // five byte values take a 32 bytes allocation each, the memory fits ten of them
+        for (auto i = 0; i < 20; ++i) {
+            auto key = "key-" + std::to_string(i);
+            auto value = "v-" + std::string(3 - std::to_string(i).length(), '0') + std::to_string(i);
+            bitcsk.Put(key.data(), value.data());
+            model[key] = value;
+        }
+        bitcsk.Put("key-large", "a value too large to inline");
+        model["key-large"] = "a value too large to inline";
+        bitcsk.Sync();
+        auto stats = bitcsk.Statistics();
+        REQUIRE(stats.num_inline_values == 10);
+        REQUIRE(stats.inline_memory == 320);
+        auto hits = bitcsk.Metrics().inline_hits;
+        verify();
+        REQUIRE(bitcsk.Metrics().inline_hits >= hits + 10);
+
+        // overwrites and deletes give the memory back
+        bitcsk.Put("key-0", "a larger value for key 0");
+        model["key-0"] = "a larger value for key 0";
+        bitcsk.Delete("key-1");
+        model.erase("key-1");
+        bitcsk.Put("key-19", "v-new");
+        model["key-19"] = "v-new";
+        bitcsk.Sync();
+        stats = bitcsk.Statistics();
+        REQUIRE(stats.num_inline_values == 9);
+        REQUIRE(stats.inline_memory == 9 * 32);
+        verify();
+
+        scanned.clear();
+        bitcsk.Scan((char*)"", collect);
+        REQUIRE(scanned == model);
+
+        // replaying the log in write order inlines them again, compaction keeps them
+        bitcsk.Close();
+        bitcsk.Open();
+        REQUIRE(bitcsk.Statistics().num_inline_values == 9);
+        REQUIRE(bitcsk.Statistics().inline_memory == 9 * 32);
+        verify();
+        bitcsk.Compact();
+        REQUIRE(bitcsk.Statistics().num_inline_values == 9);
+        verify();
+        bitcsk.Close();
+
+        // writes flushed from the memtable are inlined too
+        options.memtable_size = 256;
+        bitcaskcpp::Bitcask buffered(dir / "buffered", options);
+        buffered.Open();
+        buffered.Put("key", "v-1");
+        buffered.Put("key", "v-2");
+        buffered.Sync();
+        REQUIRE(buffered.Statistics().num_inline_values == 1);
+        REQUIRE(buffered.Statistics().inline_memory == 32);
+        REQUIRE(buffered.Get("key") == "v-2");
+        buffered.Close();
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("Data files are replayed and merged a buffer at a time", "[replay]") {
+    bitcaskcpp::BitcaskOption options;
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        std::map<std::string, std::string> model;
+        auto verify = [&](bitcaskcpp::Bitcask& bitcsk) {
+            REQUIRE(bitcsk.Size() == model.size());
+            for (const auto& [key, value] : model) {
+                REQUIRE(bitcsk.Get(key.data()) == value);
+            }
+        };
+
+        // enough records for several buffers, one of them larger than a buffer
+        std::srand(11);
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        for (auto i = 0; i < 4000; ++i) {
+            auto key = "key-" + std::to_string(std::rand() % 1000);
+            if (std::rand() % 5 == 0 && model.count(key) > 0) {
+                bitcsk.Delete(key.data());
+                model.erase(key);
+                continue;
+            }
+            auto value = std::string(1 + std::rand() % 4000, 'a' + std::rand() % 26);
+            bitcsk.Put(key.data(), value.data());
+            model[key] = value;
+        }
+        auto large = std::string((4 << 20) + 100, 'z');
+        bitcsk.Put("key-large", large.data());
+        model["key-large"] = large;
+        bitcsk.Put("key-last", "last");
+        model["key-last"] = "last";
+        auto before = bitcsk.Statistics();
+
+        bitcsk.Close();
+        bitcsk.Open();
+        verify(bitcsk);
+        REQUIRE(bitcsk.Statistics().disposable == before.disposable);
+
+        // only the records the keydir points at are copied
+        bitcsk.Compact();
+        verify(bitcsk);
+        REQUIRE(bitcsk.Statistics().disposable == 0);
+        bitcsk.Close();
+        bitcsk.Open();
+        verify(bitcsk);
+        bitcsk.Close();
+
+        // a record failing its checksum in a sealed file stops the replay
+        auto broken_path = dir / "broken";
+        auto broken_options = options;
+        broken_options.max_file_size = 32;
+        bitcaskcpp::Bitcask broken(broken_path, broken_options);
+        broken.Open();
+        broken.Put("a", "value-a");
+        broken.Put("b", "value-b");
+        std::fstream file(broken_path / "1.data", std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(bitcaskcpp::BitcaskLayout(0).GetValueOffset(1));
+        file.put('#');
+        file.close();
+        // a compaction failing on it is not reported as running
+        REQUIRE_THROWS_WITH(broken.Compact(), Catch::Contains("at offset 0"));
+        REQUIRE_FALSE(broken.Metrics().compaction_running);
+        broken.Close();
+        REQUIRE_THROWS_WITH(broken.Open(), Catch::Contains("at offset 0"));
+    });
+
+    REQUIRE(status == true);
+}
+
+TEST_CASE("A torn tail of the active file is dropped on open", "[torn-tail]") {
+    bitcaskcpp::BitcaskOption options;
+    options.direct_io = GENERATE(false, true);
+    // a short write, a header overrunning the file, a record failing its
+    // checksum and the zero padding of a direct io flush
+    std::string tail = GENERATE(std::string("garbage"),
+                                std::string(32, '\x7f'),
+                                std::string("\x01\x02\x03\x04") +
+                                    std::string(7, '\0') + "\x01" + std::string(7, '\0') +
+                                    "\x01" + "kv" + std::string(8, '\0'),
+                                std::string(4000, '\0'));
+    bool status = with("tempdir", [&](fs::path& dir) {
+        auto db_path = dir / "testdb";
+        bitcaskcpp::Bitcask bitcsk(db_path, options);
+        bitcsk.Open();
+        bitcsk.Put("a", "value-a");
+        bitcsk.Put("b", "value-b");
+        bitcsk.Delete("a");
+        auto end = bitcsk.LogEnd();
+        bitcsk.Close();
+
+        {
+            std::ofstream file(db_path / (std::to_string(end.file_id) + ".data"),
+                               std::ios::binary | std::ios::app);
+            file.write(tail.data(), tail.length());
+        }
+        bitcsk.Open();
+        REQUIRE(bitcsk.LogEnd() == end);
+        REQUIRE(bitcsk.Size() == 1);
+        REQUIRE_FALSE(bitcsk.Has("a"));
+        REQUIRE(bitcsk.Get("b") == "value-b");
+
+        // appends continue right after the last valid record
+        bitcsk.Put("c", "value-c");
+        bitcsk.Close();
+        bitcsk.Open();
+        REQUIRE(bitcsk.Size() == 2);
+        REQUIRE(bitcsk.Get("c") == "value-c");
+        bitcsk.Close();
+
+        // damage followed by valid records is not a torn tail
+        std::fstream file(db_path / (std::to_string(end.file_id) + ".data"),
+                          std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(bitcaskcpp::BitcaskLayout(0).GetValueOffset(1));
+        file.put('#');
+        file.close();
+        REQUIRE_THROWS_WITH(bitcsk.Open(), Catch::Contains("at offset 0"));
+    });
+
+    REQUIRE(status == true);
+}
 
 TEST_CASE("CRUD operation on bitcask with concurency", "[crud-close]") {
 
@@ -16,3 +16,10 @@ TEST_CASE( "ByteOrder test", "[sample]" ) {
     num = ByteOrder::fromLittleEndian<size_t>(buffer.data());
     REQUIRE(25 == num);
 }
+
+TEST_CASE( "ByteOrder writes a fixed byte order on every host", "[sample]" ) {
+    REQUIRE(ByteOrder::toBigEndianString<uint32_t>(0x01020304) == std::string("\x01\x02\x03\x04"));
+    REQUIRE(ByteOrder::toLittleEndianString<uint32_t>(0x01020304) == std::string("\x04\x03\x02\x01"));
+    REQUIRE(ByteOrder::fromBigEndian<uint16_t>("\x01\x02") == 0x0102);
+    REQUIRE(ByteOrder::fromLittleEndian<uint16_t>("\x01\x02") == 0x0201);
+}
@@ -121,7 +121,7 @@ template <class T> T *art<T>::set(const char *key, T *value) {
   if (root_ == nullptr) {
     root_ = new leaf_node<T>(value);
     root_->prefix_ = new char[key_len];
-    std::copy(key, key + key_len + 1, root_->prefix_);
+    std::copy(key, key + key_len, root_->prefix_);
     root_->prefix_len_ = key_len;
     return nullptr;
   }
@@ -195,7 +195,7 @@ template <class T> T *art<T>::set(const char *key, T *value) {
       (**cur).prefix_len_ = old_prefix_len - prefix_match_len - 1;
       std::copy(old_prefix + prefix_match_len + 1, old_prefix + old_prefix_len,
                 (**cur).prefix_);
-      delete old_prefix;
+      delete[] old_prefix;
 
       auto new_node = new leaf_node<T>(value);
       new_node->prefix_ = new char[key_len - depth - prefix_match_len - 1];
@@ -378,10 +378,16 @@ template <class T> T *art<T>::del(const char *key) {
 }
 
 template <class T> tree_it<T> art<T>::begin() {
+  if (this->root_ == nullptr) {
+    return end();
+  }
   return tree_it<T>::min(this->root_);
 }
 
 template <class T> tree_it<T> art<T>::begin(const char *key) {
+  if (this->root_ == nullptr) {
+    return end();
+  }
   return tree_it<T>::greater_equal(this->root_, key);
 }
 
@@ -11,6 +11,7 @@
 #include <cstring>
 #include <iostream>
 #include <iterator>
+#include <string>
 #include <vector>
 
 namespace art {
@@ -57,6 +58,11 @@ public:
   node<T> *get_node() const;
   int get_depth() const;
 
+  /**
+   * Reconstructs the key of the current leaf from the traversal stack.
+   */
+  std::string key() const;
+
 private:
   step &get_step();
   const step &get_step() const;
@@ -186,6 +192,22 @@ int tree_it<T>::get_depth() const {
   return get_step().depth_;
 }
 
+template <class T>
+std::string tree_it<T>::key() const {
+  std::string key;
+  for (auto it = traversal_stack_.begin(); it != traversal_stack_.end(); ++it) {
+    if (it != traversal_stack_.begin()) {
+      key.push_back(it->child_it_.get_partial_key());
+    }
+    key.append(it->node_->prefix_, it->node_->prefix_len_);
+  }
+  /* keys are stored with their null terminator */
+  if (!key.empty() && key.back() == '\0') {
+    key.pop_back();
+  }
+  return key;
+}
+
 template <class T> 
 typename tree_it<T>::step &tree_it<T>::get_step() {
   assert(!traversal_stack_.empty());